@@ -0,0 +1,482 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// End-to-end benchmark of a matrix of scenes. Every preset is rendered with a
+// fixed sample budget, on one thread and on every thread, and the throughput
+// can be compared against a baseline written by an earlier run. Run with
+// --help to see the options.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+
+#include "args.hxx"
+#include "atmosphere.hxx"
+#include "common.hxx"
+#include "json.hxx"
+#include "renderer.hxx"
+#include "stats.hxx"
+
+namespace {
+
+const float SUN_ELEVATIONS[] = {-6.0f, 0.0f, 10.0f, 30.0f, 60.0f, 90.0f};
+// Ground, a mountain top, an airliner and the International Space Station
+const float EYE_ALTITUDES[] = {0.0f, 1000.0f, 10000.0f, 400000.0f};
+const int CAMERAS[] = {0, 1};
+const char *CAMERA_NAMES[] = {"equirectangular", "fisheye"};
+
+struct Preset {
+    std::string aerosol_type;
+    float sun_elevation;
+    float eye_altitude;
+    int camera;
+
+    std::string name() const {
+        std::ostringstream out;
+        out << aerosol_type << "/elevation=" << sun_elevation << "/altitude="
+            << eye_altitude << "/" << CAMERA_NAMES[camera];
+        return out.str();
+    }
+};
+
+struct Options {
+    std::string matrix = "quick";
+    std::string filter;
+    int width = 64;
+    int height = 32;
+    int samples = 64;
+    double max_seconds = 10.0;
+    int threads = 0;
+    bool scaling = true;
+    std::string output;
+    std::string baseline;
+    double tolerance = 0.1;
+    bool list = false;
+};
+
+struct Run {
+    double seconds;
+    double samples_per_second;
+    double paths_per_second;
+    // The render was stopped by --max-seconds before using its whole budget
+    bool capped;
+};
+
+struct Result {
+    std::string name;
+    int threads;
+    Run parallel;
+    // Only if scaling is measured
+    bool has_serial;
+    Run serial;
+    double scaling_efficiency;
+};
+
+/**
+ * The default matrix varies one parameter at a time around an urban sky with
+ * the Sun at 30 degrees, seen from the ground with the fisheye camera. The
+ * full matrix has every combination, except for the fisheye camera above the
+ * atmosphere: it looks up and would only see black sky. For the same reason,
+ * the altitudes of the default matrix use the equirectangular camera, which
+ * also sees the planet.
+ */
+std::vector<Preset>
+create_presets(const std::string &matrix)
+{
+    const std::vector<std::string> &types = aerosol_type_names();
+    std::vector<Preset> presets;
+    if (matrix == "full") {
+        for (const std::string &type : types)
+            for (float elevation : SUN_ELEVATIONS)
+                for (float altitude : EYE_ALTITUDES)
+                    for (int camera : CAMERAS)
+                        if (camera == 0
+                            || EARTH_RADIUS + altitude < ATMOSPHERE_RADIUS)
+                            presets.push_back({type, elevation, altitude,
+                                               camera});
+    } else if (matrix == "quick") {
+        Preset base{"urban", 30.0f, 0.0f, 1};
+        presets.push_back(base);
+        for (const std::string &type : types) {
+            if (type != base.aerosol_type)
+                presets.push_back({type, base.sun_elevation, base.eye_altitude,
+                                   base.camera});
+        }
+        for (float elevation : SUN_ELEVATIONS) {
+            if (elevation != base.sun_elevation)
+                presets.push_back({base.aerosol_type, elevation,
+                                   base.eye_altitude, base.camera});
+        }
+        for (float altitude : EYE_ALTITUDES)
+            presets.push_back({base.aerosol_type, base.sun_elevation,
+                               altitude, 0});
+    } else {
+        throw std::runtime_error("Unknown matrix '" + matrix
+                                 + "'. Use quick or full");
+    }
+    return presets;
+}
+
+Run
+render_preset(Renderer &renderer, const Options &options, int threads)
+{
+    using namespace std::chrono;
+
+    tbb::global_control control(tbb::global_control::max_allowed_parallelism,
+                                threads);
+    reset_counters();
+
+    // Stop renders that take longer than --max-seconds
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool finished = false;
+    std::thread watchdog([&]() {
+        std::unique_lock lock(mutex);
+        if (!wakeup.wait_for(lock, duration<double>(options.max_seconds),
+                             [&]() { return finished; }))
+            renderer.cancel();
+    });
+
+    auto start = steady_clock::now();
+    renderer.render();
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    {
+        std::scoped_lock lock(mutex);
+        finished = true;
+    }
+    wakeup.notify_one();
+    watchdog.join();
+    // The watchdog may have fired between the end of the render and
+    // finished being set
+    renderer.clear_cancel();
+    bool capped = renderer.cancelled();
+
+    // Every pixel is traced, as symmetry is disabled
+    double samples = double(renderer.progress()) * options.width
+        * options.height * options.samples;
+    double paths = double(total_counters().camera_rays);
+    return {seconds, samples / seconds, paths / seconds, capped};
+}
+
+Result
+run_preset(const Preset &preset, const Options &options, int threads)
+{
+    std::vector<std::string> arguments = {
+        "skytracer", "--quiet", "--no-symmetry",
+        "-w", std::to_string(options.width),
+        "-h", std::to_string(options.height),
+        "--tile-width", "8", "--tile-height", "8",
+        "-s", std::to_string(options.samples),
+        "--aerosol-type", preset.aerosol_type,
+        "--elevation", std::to_string(preset.sun_elevation),
+        "-a", std::to_string(preset.eye_altitude),
+        "-c", std::to_string(preset.camera)
+    };
+    std::vector<char *> argv;
+    for (std::string &argument : arguments)
+        argv.push_back(argument.data());
+    CommandLineArguments args;
+    args.parse_args(argv.size(), argv.data());
+    Renderer renderer(args);
+
+    Result result;
+    result.name = preset.name();
+    result.threads = threads;
+    result.has_serial = options.scaling && threads > 1;
+    if (result.has_serial)
+        result.serial = render_preset(renderer, options, 1);
+    result.parallel = render_preset(renderer, options, threads);
+    result.scaling_efficiency = result.has_serial
+        ? result.parallel.paths_per_second
+          / (threads * result.serial.paths_per_second)
+        : 1.0;
+    return result;
+}
+
+void
+write_run(std::ostream &out, const Run &run)
+{
+    out << "{\"seconds\": " << run.seconds
+        << ", \"samples_per_second\": " << run.samples_per_second
+        << ", \"paths_per_second\": " << run.paths_per_second
+        << ", \"capped\": " << (run.capped ? "true" : "false") << "}";
+}
+
+void
+write_json(std::ostream &out, const std::vector<Result> &results,
+           const Options &options, int threads)
+{
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out.precision(6);
+    out << "{\n"
+        << "  \"context\": {\"date\": \"" << date << "\""
+        << ", \"matrix\": " << json_quote(options.matrix)
+        << ", \"width\": " << options.width
+        << ", \"height\": " << options.height
+        << ", \"samples_per_pixel\": " << options.samples
+        << ", \"threads\": " << threads
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << "},\n"
+        << "  \"presets\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        out << "    {\"name\": " << json_quote(r.name)
+            << ", \"threads\": " << r.threads
+            << ", \"samples_per_second\": " << r.parallel.samples_per_second
+            << ", \"paths_per_second\": " << r.parallel.paths_per_second
+            << ", \"scaling_efficiency\": " << r.scaling_efficiency
+            << ",\n     \"parallel\": ";
+        write_run(out, r.parallel);
+        if (r.has_serial) {
+            out << ",\n     \"serial\": ";
+            write_run(out, r.serial);
+        }
+        out << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n"
+        << "}\n";
+}
+
+/**
+ * Throw if a baseline written by --output was rendered with another image
+ * size, sample count or number of threads, as its throughput would not be
+ * comparable. Presets are matched by name, so a baseline of another matrix
+ * only gets a warning.
+ */
+void
+check_baseline_context(const JsonValue &baseline, const Options &options,
+                       int threads)
+{
+    const JsonValue *context = baseline.find("context");
+    if (!context || !context->is_object())
+        throw std::runtime_error(options.baseline + " is not a benchmark baseline");
+    auto check = [&](const std::string &key, int value) {
+        const JsonValue *stored = context->find(key);
+        if (!stored || stored->as_number() != value)
+            throw std::runtime_error(
+                options.baseline + " was recorded with " + key + " "
+                + (stored ? stored->as_string() : "unknown") + " instead of "
+                + std::to_string(value));
+    };
+    check("width", options.width);
+    check("height", options.height);
+    check("samples_per_pixel", options.samples);
+    check("threads", threads);
+    const JsonValue *matrix = context->find("matrix");
+    if (!matrix || matrix->as_string() != options.matrix)
+        std::cerr << "Warning: " << options.baseline << " was recorded with "
+                  << "another matrix, only the presets with the same name are "
+                  << "compared\n";
+}
+
+/**
+ * Compare the paths per second of every preset with a baseline written by
+ * --output. Returns the number of presets that are slower than the baseline
+ * by more than the tolerance.
+ */
+int
+compare_baseline(const JsonValue &baseline, const std::vector<Result> &results,
+                 const Options &options)
+{
+    const JsonValue *presets = baseline.find("presets");
+    if (!presets || !presets->is_array())
+        throw std::runtime_error(options.baseline + " is not a benchmark baseline");
+    std::map<std::string, double> baseline_rates;
+    for (const JsonValue &preset : presets->items()) {
+        const JsonValue *name = preset.find("name");
+        const JsonValue *rate = preset.find("paths_per_second");
+        if (name && rate)
+            baseline_rates[name->as_string()] = rate->as_number();
+    }
+
+    int regressions = 0;
+    std::cerr << "\nComparison with " << options.baseline << " (tolerance "
+              << options.tolerance * 100.0 << "%)\n";
+    for (const Result &r : results) {
+        auto it = baseline_rates.find(r.name);
+        if (it == baseline_rates.end() || it->second <= 0.0) {
+            std::cerr << "  " << std::left << std::setw(56) << r.name
+                      << std::right << "  not in the baseline\n";
+            continue;
+        }
+        double change = r.parallel.paths_per_second / it->second - 1.0;
+        bool regression = change < -options.tolerance;
+        regressions += regression;
+        std::cerr << "  " << std::left << std::setw(56) << r.name << std::right
+                  << std::showpos << std::fixed << std::setprecision(1)
+                  << std::setw(8) << change * 100.0 << "%" << std::noshowpos
+                  << (regression ? "  REGRESSION" : "") << "\n";
+        std::cerr.unsetf(std::ios::floatfield);
+    }
+    return regressions;
+}
+
+void
+print_help(const char *arg0)
+{
+    std::cout
+        << "Usage: " << arg0 << " [options]\n"
+        << "Render a matrix of scenes with a fixed sample budget and report their throughput.\n\n"
+        << "      --matrix       Presets to render: quick (one parameter varied at a time, the default) or full\n"
+        << "                     (every aerosol type, Sun elevation, eye altitude and camera)\n"
+        << "      --filter       Only render the presets whose name contains this text\n"
+        << "  -w, --width        Image width of every preset (64 by default)\n"
+        << "  -h, --height       Image height of every preset (32 by default)\n"
+        << "  -s, --samples      Samples per pixel of every preset (64 by default)\n"
+        << "      --max-seconds  Stop a render after this many seconds and report its throughput so far\n"
+        << "                     (10 by default)\n"
+        << "      --threads      Threads of the parallel renders (all of them by default)\n"
+        << "      --no-scaling   Do not render every preset on one thread to measure the scaling efficiency\n"
+        << "      --output       Write the results to this JSON file, which can be used as a baseline\n"
+        << "      --baseline     Compare the paths per second with the results of an earlier run. The exit\n"
+        << "                     status is 1 if any preset is slower than the tolerance allows\n"
+        << "      --tolerance    Allowed slowdown relative to the baseline (0.1 by default, i.e. 10%)\n"
+        << "      --list         List the presets and exit\n"
+        << std::flush;
+}
+
+Options
+parse_options(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (++i >= argc)
+                throw std::runtime_error(arg + " needs an argument");
+            return argv[i];
+        };
+        if (arg == "--help") {
+            print_help(argv[0]);
+            std::exit(EXIT_SUCCESS);
+        } else if (arg == "--matrix") {
+            options.matrix = value();
+        } else if (arg == "--filter") {
+            options.filter = value();
+        } else if (arg == "--width" || arg == "-w") {
+            options.width = std::stoi(value());
+        } else if (arg == "--height" || arg == "-h") {
+            options.height = std::stoi(value());
+        } else if (arg == "--samples" || arg == "-s") {
+            options.samples = std::stoi(value());
+        } else if (arg == "--max-seconds") {
+            options.max_seconds = std::stod(value());
+        } else if (arg == "--threads") {
+            options.threads = std::stoi(value());
+        } else if (arg == "--no-scaling") {
+            options.scaling = false;
+        } else if (arg == "--output") {
+            options.output = value();
+        } else if (arg == "--baseline") {
+            options.baseline = value();
+        } else if (arg == "--tolerance") {
+            options.tolerance = std::stod(value());
+        } else if (arg == "--list") {
+            options.list = true;
+        } else {
+            throw std::runtime_error("Unknown option '" + arg + "'. "
+                                     "Use --help to see all available options");
+        }
+    }
+    return options;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    try {
+        Options options = parse_options(argc, argv);
+        int threads = options.threads > 0
+            ? options.threads : tbb::this_task_arena::max_concurrency();
+
+        std::vector<Preset> presets;
+        for (const Preset &preset : create_presets(options.matrix)) {
+            if (preset.name().find(options.filter) != std::string::npos)
+                presets.push_back(preset);
+        }
+        if (options.list) {
+            for (const Preset &preset : presets)
+                std::cout << preset.name() << "\n";
+            return EXIT_SUCCESS;
+        }
+
+        // Check the baseline before spending time on the renders
+        JsonValue baseline;
+        if (!options.baseline.empty()) {
+            baseline = JsonValue::parse_file(options.baseline);
+            check_baseline_context(baseline, options, threads);
+        }
+
+        std::cerr << "Rendering " << presets.size() << " presets of "
+                  << options.width << "x" << options.height << " pixels and "
+                  << options.samples << " samples per pixel on " << threads
+                  << " threads\n";
+        std::vector<Result> results;
+        for (const Preset &preset : presets) {
+            Result r = run_preset(preset, options, threads);
+            std::cerr << "  " << std::left << std::setw(56) << r.name
+                      << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(9) << r.parallel.samples_per_second * 1e-6
+                      << " Msamples/s " << std::setw(9)
+                      << r.parallel.paths_per_second * 1e-6 << " Mpaths/s";
+            if (r.has_serial)
+                std::cerr << std::setprecision(2) << "  scaling "
+                          << r.scaling_efficiency;
+            if (r.parallel.capped)
+                std::cerr << "  (capped)";
+            std::cerr << "\n";
+            std::cerr.unsetf(std::ios::floatfield);
+            results.push_back(r);
+        }
+
+        if (!options.output.empty()) {
+            std::ofstream out(options.output);
+            write_json(out, results, options, threads);
+            if (!out)
+                throw std::runtime_error("Could not write " + options.output);
+        }
+        if (!options.baseline.empty()
+            && compare_baseline(baseline, results, options) > 0)
+            return EXIT_FAILURE;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+// Microbenchmarks of the kernels of the medium and the tracking code. Every
+// kernel runs on inputs drawn from fixed seeds, so the results of different
+// commits are comparable. Run with --help to see the options.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atmosphere.hxx"
+#include "camera.hxx"
+#include "integrator.hxx"
+#include "json.hxx"
+#include "lut.hxx"
+#include "phase.hxx"
+#include "random.hxx"
+#include "sampler.hxx"
+#include "stats.hxx"
+
+using namespace glm;
+
+namespace {
+
+// Inputs are cycled through, so they stay in the L1 cache
+const size_t INPUT_COUNT = 1024;
+
+/**
+ * Keep the compiler from optimizing away a result that is otherwise unused.
+ */
+template <typename T>
+void
+do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+// Runs the kernel n times
+using Kernel = std::function<void(int64_t n)>;
+
+struct Benchmark {
+    std::string name;
+    Kernel kernel;
+};
+
+struct Result {
+    std::string name;
+    int64_t iterations;
+    // Median and minimum over the repetitions
+    double ns_per_op;
+    double min_ns_per_op;
+};
+
+double
+time_kernel(const Kernel &kernel, int64_t n)
+{
+    auto start = std::chrono::steady_clock::now();
+    kernel(n);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+Result
+run_benchmark(const Benchmark &benchmark, double min_time, int repetitions)
+{
+    // Find a number of iterations that takes at least min_time
+    int64_t n = 1;
+    double seconds;
+    while ((seconds = time_kernel(benchmark.kernel, n)) < min_time / 10.0
+           && n < (int64_t(1) << 40))
+        n *= 10;
+    n = std::max<int64_t>(1, int64_t(n * min_time / std::max(seconds, 1e-9)));
+
+    std::vector<double> ns_per_op;
+    for (int i = 0; i < repetitions; ++i)
+        ns_per_op.push_back(time_kernel(benchmark.kernel, n) * 1e9 / n);
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    return {benchmark.name, n, ns_per_op[ns_per_op.size() / 2],
+            ns_per_op.front()};
+}
+
+std::vector<float>
+uniform_inputs(pcg32 &random, float min, float max)
+{
+    std::vector<float> inputs(INPUT_COUNT);
+    for (float &x : inputs)
+        x = min + (max - min) * random.next_float();
+    return inputs;
+}
+
+std::vector<vec3>
+direction_inputs(pcg32 &random, bool upper_hemisphere)
+{
+    std::vector<vec3> inputs(INPUT_COUNT);
+    for (vec3 &d : inputs) {
+        float phi = M_TWO_PI * random.next_float();
+        float cos_theta = upper_hemisphere ? random.next_float()
+                                           : 2.0f * random.next_float() - 1.0f;
+        float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+        d = vec3(cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta);
+    }
+    return inputs;
+}
+
+std::vector<Benchmark>
+create_benchmarks()
+{
+    std::vector<Benchmark> benchmarks;
+    pcg32 random(42, 54);
+
+    // A table like the aerosol cross sections: 360 to 830 nm every 5 nm
+    auto table = std::make_shared<LookupTable>();
+    for (int wl = 360; wl <= 830; wl += 5)
+        table->push_back({float(wl), 1e-12f * (1.0f + random.next_float())});
+    auto wavelengths = std::make_shared<std::vector<float>>(
+        uniform_inputs(random, 360.0f, 830.0f));
+    benchmarks.push_back({"lut_lerp", [=](int64_t n) {
+        for (int64_t i = 0; i < n; ++i)
+            do_not_optimize(lut_lerp(*table, (*wavelengths)[i % INPUT_COUNT]));
+    }});
+
+    auto heights = std::make_shared<std::vector<float>>(
+        uniform_inputs(random, 0.0f, ATMOSPHERE_THICKNESS));
+    for (const std::string &type : aerosol_type_names()) {
+        auto atmosphere = std::make_shared<GuimeraAtmosphere>(0, 1.0f, type);
+        benchmarks.push_back({"get_extinction/" + type, [=](int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+                size_t j = i % INPUT_COUNT;
+                do_not_optimize(atmosphere->get_extinction((*heights)[j],
+                                                           (*wavelengths)[j]));
+            }
+        }});
+    }
+
+    auto atmosphere = std::make_shared<GuimeraAtmosphere>(0, 1.0f, "urban");
+    auto directions = std::make_shared<std::vector<vec3>>(
+        direction_inputs(random, false));
+    auto samples = std::make_shared<std::vector<float>>(
+        uniform_inputs(random, 0.0f, 1.0f));
+    benchmarks.push_back({"phase_eval/urban", [=](int64_t n) {
+        for (int64_t i = 0; i < n; ++i) {
+            size_t j = i % INPUT_COUNT;
+            vec3 p(0.0f, 0.0f, (*heights)[j]);
+            do_not_optimize(atmosphere->phase_eval(
+                p, (*samples)[j], (*directions)[j],
+                (*directions)[(j + 1) % INPUT_COUNT], 550.0f));
+        }
+    }});
+    std::vector<std::pair<std::string, std::shared_ptr<PhaseFunction>>> phases = {
+        {"rayleigh", std::make_shared<RayleighPhase>()},
+        {"henyey_greenstein", std::make_shared<HenyeyGreenstein>(0.7f)},
+        {"chandrasekhar", std::make_shared<ChandrasekharPhase>()}
+    };
+    for (const auto &[name, phase] : phases) {
+        benchmarks.push_back({"phase/" + name, [=, phase = phase](int64_t n) {
+            for (int64_t i = 0; i < n; ++i) {
+                size_t j = i % INPUT_COUNT;
+                do_not_optimize(phase->p((*directions)[j],
+                                         (*directions)[(j + 1) % INPUT_COUNT],
+                                         550.0f));
+            }
+        }});
+    }
+
+    // Rays leaving from every altitude of the atmosphere in every direction
+    auto rays = std::make_shared<std::vector<Ray>>();
+    for (size_t i = 0; i < INPUT_COUNT; ++i)
+        rays->push_back(Ray(vec3(0.0f, 0.0f, (*heights)[i]), (*directions)[i]));
+    benchmarks.push_back({"ray_sphere_intersection", [=](int64_t n) {
+        for (int64_t i = 0; i < n; ++i)
+            do_not_optimize(ray_sphere_intersection((*rays)[i % INPUT_COUNT],
+                                                    ATMOSPHERE_RADIUS));
+    }});
+
+    // Camera rays going up from the ground until they leave the atmosphere
+    auto up_rays = std::make_shared<std::vector<Ray>>();
+    auto up_t_max = std::make_shared<std::vector<float>>();
+    for (const vec3 &d : direction_inputs(random, true)) {
+        Ray ray(vec3(0.0f), d);
+        up_rays->push_back(ray);
+        up_t_max->push_back(ray_sphere_intersection(ray, ATMOSPHERE_RADIUS));
+    }
+    benchmarks.push_back({"sample_interaction", [=](int64_t n) {
+        Sampler sampler(0, 1);
+        RenderCounters counters;
+        vec3 p;
+        for (int64_t i = 0; i < n; ++i) {
+            size_t j = i % INPUT_COUNT;
+            do_not_optimize(sample_interaction(atmosphere.get(), &sampler,
+                                               (*up_rays)[j], (*up_t_max)[j],
+                                               550.0f, p, counters));
+        }
+    }});
+    benchmarks.push_back({"transmittance", [=](int64_t n) {
+        Sampler sampler(0, 1);
+        RenderCounters counters;
+        for (int64_t i = 0; i < n; ++i) {
+            size_t j = i % INPUT_COUNT;
+            do_not_optimize(transmittance(atmosphere.get(), &sampler,
+                                          (*up_rays)[j], (*up_t_max)[j],
+                                          550.0f, counters));
+        }
+    }});
+
+    benchmarks.push_back({"pcg32::next_float", [](int64_t n) {
+        pcg32 generator;
+        for (int64_t i = 0; i < n; ++i)
+            do_not_optimize(generator.next_float());
+    }});
+
+    auto uvs = std::make_shared<std::vector<vec2>>();
+    for (size_t i = 0; i < INPUT_COUNT; ++i)
+        uvs->push_back(vec2(random.next_float(), random.next_float()));
+    std::vector<std::pair<std::string, std::shared_ptr<Camera>>> cameras = {
+        {"equirectangular", std::make_shared<EquirectangularCamera>(0.0f)},
+        {"fisheye", std::make_shared<FisheyeCamera>(0.0f, 1.0f)},
+        {"perspective", std::make_shared<PerspectiveCamera>(
+            0.0f, 10.0f, 0.0f, 60.0f, 1.0f)}
+    };
+    for (const auto &[name, camera] : cameras) {
+        benchmarks.push_back({"sample_ray/" + name,
+                              [=, camera = camera](int64_t n) {
+            Ray ray;
+            for (int64_t i = 0; i < n; ++i) {
+                do_not_optimize(camera->sample_ray(ray, (*uvs)[i % INPUT_COUNT]));
+                do_not_optimize(ray.d.x);
+            }
+        }});
+    }
+    return benchmarks;
+}
+
+void
+write_json(std::ostream &out, const std::vector<Result> &results,
+           double min_time, int repetitions)
+{
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out.precision(6);
+    out << "{\n"
+        << "  \"context\": {\"date\": \"" << date << "\""
+#ifdef __VERSION__
+        << ", \"compiler\": " << json_quote(__VERSION__)
+#endif
+#ifdef NDEBUG
+        << ", \"assertions\": false"
+#else
+        << ", \"assertions\": true"
+#endif
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << ", \"min_time\": " << min_time
+        << ", \"repetitions\": " << repetitions << "},\n"
+        << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        out << "    {\"name\": " << json_quote(r.name)
+            << ", \"iterations\": " << r.iterations
+            << ", \"ns_per_op\": " << r.ns_per_op
+            << ", \"min_ns_per_op\": " << r.min_ns_per_op << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n"
+        << "}\n";
+}
+
+void
+print_help(const char *arg0)
+{
+    std::cout
+        << "Usage: " << arg0 << " [options]\n"
+        << "Time the medium and tracking kernels and write the results as JSON.\n\n"
+        << "      --filter       Only run the benchmarks whose name contains this text\n"
+        << "      --min-time     Seconds each repetition runs for (0.2 by default)\n"
+        << "      --repetitions  Times each benchmark is repeated, the median is reported (5 by default)\n"
+        << "      --output       Write the JSON results to this file instead of stdout\n"
+        << "      --list         List the benchmarks and exit\n"
+        << std::flush;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    try {
+        std::string filter;
+        std::string output;
+        double min_time = 0.2;
+        int repetitions = 5;
+        bool list = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (++i >= argc)
+                    throw std::runtime_error(arg + " needs an argument");
+                return argv[i];
+            };
+            if (arg == "--help") {
+                print_help(argv[0]);
+                return EXIT_SUCCESS;
+            } else if (arg == "--filter") {
+                filter = value();
+            } else if (arg == "--min-time") {
+                min_time = std::stod(value());
+            } else if (arg == "--repetitions") {
+                repetitions = std::max(1, std::stoi(value()));
+            } else if (arg == "--output") {
+                output = value();
+            } else if (arg == "--list") {
+                list = true;
+            } else {
+                throw std::runtime_error("Unknown option '" + arg + "'. "
+                                         "Use --help to see all available options");
+            }
+        }
+
+        std::vector<Result> results;
+        for (const Benchmark &benchmark : create_benchmarks()) {
+            if (benchmark.name.find(filter) == std::string::npos)
+                continue;
+            if (list) {
+                std::cout << benchmark.name << "\n";
+                continue;
+            }
+            Result result = run_benchmark(benchmark, min_time, repetitions);
+            std::cerr.precision(4);
+            std::cerr << result.name << ": " << result.ns_per_op << " ns/op\n";
+            results.push_back(result);
+        }
+        if (list)
+            return EXIT_SUCCESS;
+
+        if (output.empty()) {
+            write_json(std::cout, results, min_time, repetitions);
+        } else {
+            std::ofstream out(output);
+            write_json(out, results, min_time, repetitions);
+            if (!out)
+                throw std::runtime_error("Could not write " + output);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include "args.hxx"
+#include "cache.hxx"
+#include "jobs.hxx"
+#include "renderer.hxx"
+
+namespace py = pybind11;
+
+namespace {
+
+// Atmospheres are reused across calls, e.g. when looping over wavelengths
+AtmosphereCache atmospheres;
+
+/**
+ * Turn positional strings and keyword arguments into skytracer options.
+ * Underscores in keywords become dashes, so aerosol_type="rural" is the same
+ * as --aerosol-type rural. True enables a flag and lists repeat an option.
+ */
+std::unique_ptr<CommandLineArguments>
+make_arguments(const py::args &args, const py::kwargs &kwargs)
+{
+    std::vector<std::string> options = {"skytracer"};
+    for (const py::handle &arg : args)
+        options.push_back(py::str(arg));
+    for (const auto &[key, value] : kwargs) {
+        std::string option = "--" + std::string(py::str(key));
+        std::replace(option.begin(), option.end(), '_', '-');
+        if (py::isinstance<py::bool_>(value)) {
+            if (value.cast<bool>())
+                options.push_back(option);
+        } else if (py::isinstance<py::list>(value)
+                   || py::isinstance<py::tuple>(value)) {
+            for (const py::handle &item : value) {
+                options.push_back(option);
+                options.push_back(py::str(item));
+            }
+        } else {
+            options.push_back(option);
+            options.push_back(py::str(value));
+        }
+    }
+
+    std::vector<char *> argv;
+    for (std::string &option : options)
+        argv.push_back(option.data());
+    auto parsed = std::make_unique<CommandLineArguments>();
+    parsed->parse_args(argv.size(), argv.data());
+    if (parsed->help || parsed->list_types)
+        throw std::runtime_error("--help and --list-aerosol-types are not "
+                                 "supported by the Python module");
+    if (!parsed->views.empty() || !parsed->jobs_filename.empty()
+        || !parsed->socket_path.empty() || parsed->stream)
+        throw std::runtime_error("Views, jobs, servers and streaming are not "
+                                 "supported by the Python module");
+    return parsed;
+}
+
+std::unique_ptr<Renderer>
+make_renderer(const CommandLineArguments &args)
+{
+    Scene shared;
+    shared.atmosphere = atmospheres.get(args);
+    return std::make_unique<Renderer>(args, args.main_view(), &shared);
+}
+
+py::array_t<float>
+render(const py::args &args, const py::kwargs &kwargs)
+{
+    auto arguments = make_arguments(args, kwargs);
+    std::unique_ptr<std::vector<float>> pixels;
+    py::ssize_t width, height;
+    {
+        // Rendering does not touch any Python object
+        py::gil_scoped_release release;
+        auto renderer = make_renderer(*arguments);
+        render_cached(*renderer, *arguments);
+        if (arguments->denoise)
+            renderer->denoise();
+        width = renderer->window().width();
+        height = renderer->window().height();
+        pixels = std::make_unique<std::vector<float>>(renderer->take_buffer());
+    }
+    // The array takes ownership of the framebuffer instead of copying it
+    float *data = pixels->data();
+    py::capsule owner(pixels.release(), [](void *p) {
+        delete static_cast<std::vector<float> *>(p);
+    });
+    return py::array_t<float>(std::vector<py::ssize_t>{height, width}, data,
+                              owner);
+}
+
+py::array_t<float>
+render_directions(
+    py::array_t<float, py::array::c_style | py::array::forcecast> directions,
+    const py::args &args, const py::kwargs &kwargs)
+{
+    if (directions.ndim() != 2 || directions.shape(1) != 3)
+        throw std::runtime_error("The directions must be an array of shape (n, 3)");
+    auto arguments = make_arguments(args, kwargs);
+    size_t count = directions.shape(0);
+    py::array_t<float> radiance(count);
+    const float *input = directions.data();
+    float *output = radiance.mutable_data();
+    {
+        py::gil_scoped_release release;
+        std::vector<glm::vec3> dirs(count);
+        for (size_t i = 0; i < count; ++i)
+            dirs[i] = glm::vec3(input[3 * i], input[3 * i + 1], input[3 * i + 2]);
+        auto renderer = make_renderer(*arguments);
+        renderer->render_directions(dirs.data(), count, output);
+    }
+    return radiance;
+}
+
+} // anonymous namespace
+
+PYBIND11_MODULE(skytracer, m) {
+    m.doc() = "In-process interface to the skytracer renderer";
+
+    m.def("render", &render,
+          "Render an image and return it as a float32 array of shape "
+          "(height, width).\n\n"
+          "Takes the same options as the skytracer executable, either as "
+          "strings (render('-l', '450')) or as keywords (render(wavelength=450,"
+          " aerosol_type='rural')).");
+    m.def("render_directions", &render_directions, py::arg("directions"),
+          "Estimate the radiance seen from the camera position in each "
+          "direction of an (n, 3) array. Takes the same options as render().");
+}
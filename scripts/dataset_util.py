@@ -0,0 +1,31 @@
+import json
+import numpy as np
+
+
+def load_dataset(path):
+    """
+    Map a dataset container written by skytracer --dataset.
+    @return A tuple (parameters, images, info). parameters is an nx4 array with
+            the Sun elevation, turbidity, month and aerosol type index of every
+            image, images is an array of shape (n, height, width) backed by the
+            file and info is a dict with the aerosol type names, the
+            wavelength and the samples per pixel.
+    """
+    header = np.fromfile(path, dtype=np.uint8, count=4096)
+    if header[:8].tobytes() != b"SKYDSET\0":
+        raise ValueError(path + " is not a skytracer dataset")
+    version, width, height, parameter_count = header[8:24].view(np.uint32)
+    record_count, record_size, data_offset = header[24:48].view(np.uint64)
+    wavelength = header[48:52].view(np.float32)[0]
+    samples = header[52:56].view(np.uint32)[0]
+    description = header[64:].tobytes().split(b"\0")[0]
+    info = json.loads(description)
+    info["wavelength"] = float(wavelength)
+    info["samples"] = int(samples)
+
+    records = np.memmap(path, dtype=np.float32, mode="r", offset=int(data_offset),
+                        shape=(int(record_count), int(record_size) // 4))
+    parameters = records[:, :parameter_count]
+    # The pixels start 64 bytes into every record
+    images = records[:, 16:16 + width * height].reshape(-1, height, width)
+    return parameters, images, info
@@ -0,0 +1,105 @@
+import argparse
+import numpy as np
+
+
+PATH_DTYPE = np.dtype([("x", "<u4"), ("y", "<u4"), ("sample", "<u4"),
+                       ("vertex_count", "<u4"), ("wavelength", "<f4"),
+                       ("radiance", "<f4"), ("end", "<u4"),
+                       ("truncated", "<u4")])
+VERTEX_DTYPE = np.dtype([("position", "<f4", 3), ("throughput", "<f4"),
+                         ("contribution", "<f4"), ("type", "<u4")])
+
+PATH_ENDS = ["escaped", "absorbed", "terminated", "max_order"]
+VERTEX_TYPES = ["camera", "scattering", "ground", "absorption", "exit"]
+
+
+def load_paths(filename):
+    """
+    Read a path log written by skytracer --record-paths.
+    @return A list of (path, vertices) tuples, where path is a record of
+            PATH_DTYPE and vertices an array of VERTEX_DTYPE.
+    """
+    data = np.fromfile(filename, dtype=np.uint8)
+    if data[:8].tobytes() != b"SKYPATHS":
+        raise ValueError(filename + " is not a skytracer path log")
+    version, vertex_size = data[8:16].view("<u4")
+    if vertex_size != VERTEX_DTYPE.itemsize:
+        raise ValueError("Unsupported path log version " + str(version))
+    paths = []
+    offset = 16
+    while offset + PATH_DTYPE.itemsize <= len(data):
+        path = data[offset:offset + PATH_DTYPE.itemsize].view(PATH_DTYPE)[0]
+        offset += PATH_DTYPE.itemsize
+        size = int(path["vertex_count"]) * VERTEX_DTYPE.itemsize
+        vertices = data[offset:offset + size].view(VERTEX_DTYPE)
+        offset += size
+        paths.append((path, vertices))
+    return paths
+
+
+def write_csv(paths, filename):
+    """
+    Write one row per vertex, with the path it belongs to.
+    """
+    with open(filename, "w") as f:
+        f.write("path,pixel_x,pixel_y,sample,wavelength,radiance,end,vertex,"
+                "type,x,y,z,throughput,contribution\n")
+        for i, (path, vertices) in enumerate(paths):
+            prefix = "{},{},{},{},{},{},{}".format(
+                i, path["x"], path["y"], path["sample"], path["wavelength"],
+                path["radiance"], PATH_ENDS[path["end"]])
+            for j, v in enumerate(vertices):
+                f.write("{},{},{},{},{},{},{},{}\n".format(
+                    prefix, j, VERTEX_TYPES[v["type"]], *v["position"],
+                    v["throughput"], v["contribution"]))
+
+
+def write_ply(paths, filename):
+    """
+    Write the vertices as points and the path segments as edges. The vertices
+    are colored by type and the path segments keep the order of the path.
+    """
+    colors = [(255, 255, 255), (80, 160, 255), (60, 200, 60), (255, 60, 60),
+              (255, 200, 0)]
+    vertex_count = sum(len(v) for _, v in paths)
+    edge_count = sum(max(len(v) - 1, 0) for _, v in paths)
+    with open(filename, "w") as f:
+        f.write("ply\nformat ascii 1.0\n"
+                "element vertex {}\n".format(vertex_count) +
+                "property float x\nproperty float y\nproperty float z\n"
+                "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+                "property float throughput\nproperty float contribution\n"
+                "element edge {}\n".format(edge_count) +
+                "property int vertex1\nproperty int vertex2\n"
+                "end_header\n")
+        for _, vertices in paths:
+            for v in vertices:
+                f.write("{} {} {} {} {} {} {} {}\n".format(
+                    *v["position"], *colors[v["type"]], v["throughput"],
+                    v["contribution"]))
+        first = 0
+        for _, vertices in paths:
+            for j in range(len(vertices) - 1):
+                f.write("{} {}\n".format(first + j, first + j + 1))
+            first += len(vertices)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Convert a path log written by skytracer --record-paths to CSV or PLY.")
+    parser.add_argument("log", type=str,
+                        help="Path log")
+    parser.add_argument("output", type=str,
+                        help="Output file. The format is given by the extension, .csv or .ply")
+    args = parser.parse_args()
+
+    paths = load_paths(args.log)
+    if args.output.endswith(".ply"):
+        write_ply(paths, args.output)
+    else:
+        write_csv(paths, args.output)
+    print("Wrote " + str(len(paths)) + " paths to [ " + args.output + " ]")
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,13 @@ import tempfile
 
 from spectral_util import *
 
+# The Python module renders in-process, without writing temporary EXR files.
+# It is only available if skytracer was built with -DSKYTRACER_PYTHON=ON.
+try:
+    import skytracer
+except ImportError:
+    skytracer = None
+
 
 def render_rgb_image(executable_path, cmf_path, args, wavelength_array):
     # Save monospectral images to a temporary directory
@@ -29,6 +36,19 @@ def render_rgb_image(executable_path, cmf_path, args, wavelength_array):
         image = tristimulus_image_from_spectral_image(cmf, lambdas, image_stack)
         return image
 
+def render_rgb_image_in_process(cmf_path, args, wavelength_array):
+    image_stack = []
+    for i, wavelength in enumerate(wavelength_array):
+        print("Wavelength = " + str(wavelength) + " nm, " +
+              str(i+1) + "/" + str(len(wavelength_array)))
+        image_stack.append(skytracer.render("-l", str(wavelength), *args))
+    lambdas = np.array(wavelength_array, dtype=np.float32)
+    image_stack = np.dstack(image_stack)
+    cmf = load_resampled_cmf_from_csv(cmf_path, lambdas)
+    cmf = cmf_xyz_to_linear_srgb(cmf)
+    image = tristimulus_image_from_spectral_image(cmf, lambdas, image_stack)
+    return image
+
 def main():
     ignored_args = ["--list-aerosol-types"]
     if any(x in sys.argv[1:] for x in ignored_args):
@@ -51,6 +71,8 @@ def main():
     parser.add_argument("--exec", type=str,
                         default=default_exec_file,
                         help="Path to the skytracer executable")
+    parser.add_argument("--subprocess", action="store_true",
+                        help="Run the skytracer executable even if the Python module is available")
     parser.add_argument("--cmf", type=str,
                         default=default_cmf_file,
                         help="Path to the CSV file containing the tabulated values for the CIE color matching functions")
@@ -69,7 +91,10 @@ def main():
     args, skytracer_args = parser.parse_known_args()
 
     wavelength_array = range(args.begin, args.end, args.step)
-    image = render_rgb_image(args.exec, args.cmf, skytracer_args, wavelength_array)
+    if skytracer is not None and not args.subprocess:
+        image = render_rgb_image_in_process(args.cmf, skytracer_args, wavelength_array)
+    else:
+        image = render_rgb_image(args.exec, args.cmf, skytracer_args, wavelength_array)
 
     # Tonemap and gamma correct to obtain an LDR image
     ldr_image = to_ldr(image, args.exposure)
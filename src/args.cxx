@@ -21,10 +21,31 @@
 
 #include "args.hxx"
 
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <stdexcept>
 
+#include "atmosphere.hxx"
+
+namespace {
+
+// Parse a "MIN:MAX" range given to option
+void
+parse_range(const std::string &option, const std::string &value,
+            float &min, float &max)
+{
+    size_t colon = value.find(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error(option + " needs a range like 0:90");
+    min = std::stof(value.substr(0, colon));
+    max = std::stof(value.substr(colon + 1));
+    if (min > max)
+        throw std::runtime_error(option + " needs a range with MIN <= MAX");
+}
+
+} // anonymous namespace
+
 CommandLineArguments::CommandLineArguments()
 {
 }
@@ -33,11 +54,14 @@ void
 CommandLineArguments::parse_args(int argc, char **argv)
 {
     bool filename_given = false;
+    std::vector<std::string> view_specs;
     for (int i = 1; i < argc; ++i) {
+        int first = i;
+        bool is_base_arg = true;
         std::string arg(argv[i]);
         if (arg == "--help") {
-            print_help(argv[0]);
-            exit(EXIT_SUCCESS);
+            help = true;
+            return;
         } else if (arg == "--width" || arg == "-w") {
             if (++i >= argc) {
                 throw std::runtime_error("--width needs an argument");
@@ -86,6 +110,52 @@ CommandLineArguments::parse_args(int argc, char **argv)
             } else {
                 camera = std::stoi(argv[i]);
             }
+        } else if (arg == "--upper-hemisphere") {
+            upper_hemisphere = true;
+        } else if (arg == "--horizon-exponent") {
+            if (++i >= argc) {
+                throw std::runtime_error("--horizon-exponent needs an argument");
+            } else {
+                horizon_exponent = std::stof(argv[i]);
+            }
+        } else if (arg == "--jacobian") {
+            if (++i >= argc) {
+                throw std::runtime_error("--jacobian needs an argument");
+            } else {
+                jacobian_filename = std::string(argv[i]);
+            }
+        } else if (arg == "--view-elevation") {
+            if (++i >= argc) {
+                throw std::runtime_error("--view-elevation needs an argument");
+            } else {
+                view_elevation = std::stof(argv[i]);
+            }
+        } else if (arg == "--view-azimuth") {
+            if (++i >= argc) {
+                throw std::runtime_error("--view-azimuth needs an argument");
+            } else {
+                view_azimuth = std::stof(argv[i]);
+            }
+        } else if (arg == "--fov") {
+            if (++i >= argc) {
+                throw std::runtime_error("--fov needs an argument");
+            } else {
+                fov = std::stof(argv[i]);
+            }
+        } else if (arg == "--crop") {
+            if (++i >= argc) {
+                throw std::runtime_error("--crop needs an argument");
+            } else if (sscanf(argv[i], "%d,%d,%d,%d", &crop_x, &crop_y,
+                              &crop_width, &crop_height) != 4
+                       || crop_width <= 0 || crop_height <= 0) {
+                throw std::runtime_error("--crop expects X,Y,WIDTH,HEIGHT");
+            }
+        } else if (arg == "--view") {
+            if (++i >= argc) {
+                throw std::runtime_error("--view needs an argument");
+            } else {
+                view_specs.push_back(argv[i]);
+            }
         } else if (arg == "--atmospheric-model") {
             if (++i >= argc) {
                 throw std::runtime_error("--atmospheric-model needs an argument");
@@ -99,8 +169,8 @@ CommandLineArguments::parse_args(int argc, char **argv)
                 aerosol_type = std::string(argv[i]);
             }
         } else if (arg == "--list-aerosol-types") {
-            list_aerosol_types();
-            exit(EXIT_SUCCESS);
+            list_types = true;
+            return;
         } else if (arg == "--turbidity") {
             if (++i >= argc) {
                 throw std::runtime_error("--turbidity needs an argument");
@@ -145,10 +215,251 @@ CommandLineArguments::parse_args(int argc, char **argv)
             } else {
                 eye_altitude = std::stof(argv[i]);
             }
+        } else if (arg == "--no-symmetry") {
+            symmetry = false;
+        } else if (arg == "--adaptive") {
+            adaptive = true;
+        } else if (arg == "--adaptive-step") {
+            if (++i >= argc) {
+                throw std::runtime_error("--adaptive-step needs an argument");
+            } else {
+                adaptive_step = std::stoi(argv[i]);
+            }
+        } else if (arg == "--adaptive-threshold") {
+            if (++i >= argc) {
+                throw std::runtime_error("--adaptive-threshold needs an argument");
+            } else {
+                adaptive_threshold = std::stof(argv[i]);
+            }
+        } else if (arg == "--error-map") {
+            if (++i >= argc) {
+                throw std::runtime_error("--error-map needs an argument");
+            } else {
+                error_map_filename = std::string(argv[i]);
+            }
+        } else if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--denoise-radius") {
+            if (++i >= argc) {
+                throw std::runtime_error("--denoise-radius needs an argument");
+            } else {
+                denoise_radius = std::stoi(argv[i]);
+            }
+        } else if (arg == "--denoise-strength") {
+            if (++i >= argc) {
+                throw std::runtime_error("--denoise-strength needs an argument");
+            } else {
+                denoise_strength = std::stof(argv[i]);
+            }
+        } else if (arg == "--features") {
+            if (++i >= argc) {
+                throw std::runtime_error("--features needs an argument");
+            } else {
+                features_filename = std::string(argv[i]);
+            }
+        } else if (arg == "--cost") {
+            if (++i >= argc) {
+                throw std::runtime_error("--cost needs an argument");
+            } else {
+                cost_filename = std::string(argv[i]);
+            }
+        } else if (arg == "--half") {
+            half_float = true;
+        } else if (arg == "--compression") {
+            if (++i >= argc) {
+                throw std::runtime_error("--compression needs an argument");
+            } else {
+                compression = std::string(argv[i]);
+            }
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--publish") {
+            if (++i >= argc) {
+                throw std::runtime_error("--publish needs an argument");
+            } else {
+                publish_target = std::string(argv[i]);
+            }
+        } else if (arg == "--publish-interval") {
+            if (++i >= argc) {
+                throw std::runtime_error("--publish-interval needs an argument");
+            } else {
+                publish_interval = std::stof(argv[i]);
+                if (!(publish_interval > 0.0f))
+                    throw std::runtime_error("--publish-interval must be positive");
+            }
+        } else if (arg == "--cache") {
+            if (++i >= argc) {
+                throw std::runtime_error("--cache needs an argument");
+            } else {
+                cache_directory = std::string(argv[i]);
+            }
+        } else if (arg == "--quiet" || arg == "-q") {
+            quiet = true;
+        } else if (arg == "--progress") {
+            if (++i >= argc) {
+                throw std::runtime_error("--progress needs an argument");
+            } else {
+                progress_format = std::string(argv[i]);
+            }
+        } else if (arg.compare(0, 11, "--progress=") == 0) {
+            progress_format = arg.substr(11);
+        } else if (arg == "--metrics") {
+            if (++i >= argc) {
+                throw std::runtime_error("--metrics needs an argument");
+            } else {
+                metrics_filename = std::string(argv[i]);
+            }
+        } else if (arg == "--metrics-interval") {
+            if (++i >= argc) {
+                throw std::runtime_error("--metrics-interval needs an argument");
+            } else {
+                metrics_interval = std::stof(argv[i]);
+                if (!(metrics_interval > 0.0f))
+                    throw std::runtime_error("--metrics-interval must be positive");
+            }
+        } else if (arg == "--progress-interval") {
+            if (++i >= argc) {
+                throw std::runtime_error("--progress-interval needs an argument");
+            } else {
+                progress_interval = std::stof(argv[i]);
+                if (!(progress_interval > 0.0f))
+                    throw std::runtime_error("--progress-interval must be positive");
+            }
+        } else if (arg == "--trace") {
+            if (++i >= argc) {
+                throw std::runtime_error("--trace needs an argument");
+            } else {
+                trace_filename = std::string(argv[i]);
+                is_base_arg = false;
+            }
+        } else if (arg == "--stats") {
+            if (++i >= argc) {
+                throw std::runtime_error("--stats needs an argument");
+            } else {
+                stats_filename = std::string(argv[i]);
+                is_base_arg = false;
+            }
+        } else if (arg == "--perf-counters") {
+            perf_counters = true;
+            is_base_arg = false;
+        } else if (arg == "--record-paths") {
+            if (++i >= argc) {
+                throw std::runtime_error("--record-paths needs an argument");
+            } else {
+                record_paths_filename = std::string(argv[i]);
+                is_base_arg = false;
+            }
+        } else if (arg == "--record-every") {
+            if (++i >= argc) {
+                throw std::runtime_error("--record-every needs an argument");
+            } else {
+                record_every = std::stoi(argv[i]);
+                if (record_every < 1)
+                    throw std::runtime_error("--record-every must be at least 1");
+            }
+        } else if (arg == "--record-pixel") {
+            if (++i >= argc) {
+                throw std::runtime_error("--record-pixel needs an argument");
+            } else {
+                std::string value = argv[i];
+                size_t comma = value.find(',');
+                if (comma == std::string::npos)
+                    throw std::runtime_error("--record-pixel needs a pixel like 10,20");
+                record_pixels.push_back({std::stoi(value.substr(0, comma)),
+                                         std::stoi(value.substr(comma + 1))});
+            }
+        } else if (arg == "--jobs") {
+            if (++i >= argc) {
+                throw std::runtime_error("--jobs needs an argument");
+            } else {
+                jobs_filename = std::string(argv[i]);
+                is_base_arg = false;
+            }
+        } else if (arg == "--serve") {
+            if (++i >= argc) {
+                throw std::runtime_error("--serve needs an argument");
+            } else {
+                socket_path = std::string(argv[i]);
+                is_base_arg = false;
+            }
+        } else if (arg == "--dataset") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset needs an argument");
+            } else {
+                dataset_filename = std::string(argv[i]);
+                is_base_arg = false;
+            }
+        } else if (arg == "--dataset-size") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset-size needs an argument");
+            } else {
+                dataset_size = std::stoi(argv[i]);
+            }
+        } else if (arg == "--dataset-sampling") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset-sampling needs an argument");
+            } else {
+                dataset_sampling = std::string(argv[i]);
+            }
+        } else if (arg == "--dataset-elevation") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset-elevation needs an argument");
+            } else {
+                parse_range(arg, argv[i], dataset_elevation[0],
+                            dataset_elevation[1]);
+            }
+        } else if (arg == "--dataset-turbidity") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset-turbidity needs an argument");
+            } else {
+                parse_range(arg, argv[i], dataset_turbidity[0],
+                            dataset_turbidity[1]);
+            }
+        } else if (arg == "--dataset-months") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset-months needs an argument");
+            } else {
+                float min, max;
+                parse_range(arg, argv[i], min, max);
+                dataset_months[0] = int(min);
+                dataset_months[1] = int(max);
+            }
+        } else if (arg == "--dataset-aerosol-type") {
+            if (++i >= argc) {
+                throw std::runtime_error("--dataset-aerosol-type needs an argument");
+            } else {
+                dataset_aerosol_types.push_back(argv[i]);
+            }
+        } else if (arg == "--spectral-basis") {
+            if (++i >= argc) {
+                throw std::runtime_error("--spectral-basis needs an argument");
+            } else {
+                spectral_basis = std::stoi(argv[i]);
+            }
+        } else if (arg == "--spectral-range") {
+            if (++i >= argc) {
+                throw std::runtime_error("--spectral-range needs an argument");
+            } else {
+                parse_range(arg, argv[i], spectral_range[0], spectral_range[1]);
+            }
+        } else if (arg == "--spectral-samples") {
+            if (++i >= argc) {
+                throw std::runtime_error("--spectral-samples needs an argument");
+            } else {
+                spectral_samples = std::stoi(argv[i]);
+            }
+        } else if (arg == "--reconstruct") {
+            if (++i >= argc) {
+                throw std::runtime_error("--reconstruct needs an argument");
+            } else {
+                reconstruct_filename = std::string(argv[i]);
+                is_base_arg = false;
+            }
         } else if (arg[0] != '-') {
             if (!filename_given) {
                 filename = arg;
                 filename_given = true;
+                is_base_arg = false;
             } else {
                 throw std::runtime_error("Only one output filename allowed");
             }
@@ -156,7 +467,62 @@ CommandLineArguments::parse_args(int argc, char **argv)
             throw std::runtime_error("Unknown option '" + arg + "'. "
                                      "Use --help to see all available options");
         }
+        if (is_base_arg) {
+            for (int j = first; j <= i; ++j)
+                base_args.push_back(argv[j]);
+        }
     }
+
+    // Parse the views once all the options are known, as they are used as
+    // defaults.
+    for (const std::string &spec : view_specs)
+        views.push_back(parse_view(spec));
+}
+
+CameraView
+CommandLineArguments::main_view() const
+{
+    return CameraView{camera, eye_altitude, view_elevation, view_azimuth, fov,
+                      filename};
+}
+
+CameraView
+CommandLineArguments::parse_view(const std::string &spec) const
+{
+    CameraView view = main_view();
+    view.filename.clear();
+    size_t begin = 0;
+    while (begin < spec.size()) {
+        size_t end = spec.find(',', begin);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(begin, end - begin);
+        begin = end + 1;
+
+        size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            throw std::runtime_error("Invalid view option '" + item + "'");
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+        if (key == "camera") {
+            view.camera = std::stoi(value);
+        } else if (key == "altitude") {
+            view.eye_altitude = std::stof(value);
+        } else if (key == "view-elevation") {
+            view.view_elevation = std::stof(value);
+        } else if (key == "view-azimuth") {
+            view.view_azimuth = std::stof(value);
+        } else if (key == "fov") {
+            view.fov = std::stof(value);
+        } else if (key == "output") {
+            view.filename = value;
+        } else {
+            throw std::runtime_error("Unknown view option '" + key + "'");
+        }
+    }
+    if (view.filename.empty())
+        throw std::runtime_error("--view needs an output filename");
+    return view;
 }
 
 void
@@ -172,7 +538,19 @@ CommandLineArguments::print_help(const char *arg0) const
         << "  -l, --wavelength             Wavelength to sample in nanometers (550nm by default)\n"
         << "  -i, --integrator             Integrator to use (0=path tracer (default), 1=transmittance)\n"
         << "  -s, --samples                Number of path tracing samples per pixel (512 by default)\n"
-        << "  -c, --camera                 Camera type (0=equirectangular, 1=fisheye (default))\n"
+        << "  -c, --camera                 Camera type (0=equirectangular, 1=fisheye (default), 2=perspective)\n"
+        << "      --upper-hemisphere       Only map the upper hemisphere (equirectangular camera only)\n"
+        << "      --horizon-exponent       Elevation mapping exponent, >1 dedicates more texels to the horizon\n"
+        << "                               (equirectangular camera only, 1=linear (default))\n"
+        << "      --view-elevation         Elevation of the view direction in degrees (perspective camera only, 0 by default)\n"
+        << "      --view-azimuth           Azimuth of the view direction in degrees (perspective camera only, 0 by default)\n"
+        << "      --fov                    Vertical field of view in degrees (perspective camera only, 60 by default)\n"
+        << "      --crop                   Only render the region X,Y,WIDTH,HEIGHT of the image (in pixels)\n"
+        << "      --view                   Render an additional view into its own file, given as\n"
+        << "                               camera=C,altitude=A,view-elevation=E,view-azimuth=Z,fov=F,output=FILE.\n"
+        << "                               Only output is mandatory. Can be repeated to batch render several views\n"
+        << "                               sharing the same atmosphere. The main output file is not written\n"
+        << "      --jacobian               Also write the solid angle per pixel of the camera mapping to this EXR file\n"
         << "      --atmospheric-model      Atmospheric model to use (0=Guimera (default))\n"
         << "      --aerosol-type           Aerosol type to use ('urban' by default)\n"
         << "      --list-aerosol-types     List all aerosol types\n"
@@ -184,6 +562,59 @@ CommandLineArguments::print_help(const char *arg0) const
         << "      --elevation              Sun elevation angle in degrees (0=horizon (default), 90=zenith)\n"
         << "      --azimuth                Sun azimuth angle in degrees (0 by default)\n"
         << "  -a, --eye-altitude           Set the altitude of the camera above sea level in meters (0m by default)\n"
+        << "      --half                   Save the EXR images with half-float channels\n"
+        << "      --compression            EXR compression: none, rle, zips, zip (default) or piz\n"
+        << "      --stream                 Write the output as a tiled EXR image while rendering, without keeping\n"
+        << "                               the whole image in memory. Also writes the variance of every pixel\n"
+        << "      --publish                Publish the framebuffer while rendering, to a POSIX shared memory segment\n"
+        << "                               (shm:NAME) or as raw float frames to a file, named pipe or stdout (-)\n"
+        << "      --publish-interval       Seconds between published frames (1 by default)\n"
+        << "      --cache                  Directory of a render cache. Renders with the same options are reused,\n"
+        << "                               topped up with more samples or rotated to a new Sun azimuth when possible\n"
+        << "  -q, --quiet                  Do not print progress information\n"
+        << "      --progress               Progress output: a bar with the throughput and remaining time (bar, the\n"
+        << "                               default) or one JSON object per line (json)\n"
+        << "      --progress-interval      Seconds between progress updates (1 by default)\n"
+        << "      --metrics                Write the progress, throughput, memory and thread usage of the render to\n"
+        << "                               this Prometheus textfile (e.g. for the node_exporter textfile collector)\n"
+        << "      --metrics-interval       Seconds between metrics updates (15 by default)\n"
+        << "      --stats                  Write the path tracing counters and the time of each phase to this\n"
+        << "                               JSON file\n"
+        << "      --perf-counters          Count CPU cycles, instructions, cache and branch misses and stalls while\n"
+        << "                               rendering. Reported by --stats, and per tile by --trace (Linux only)\n"
+        << "      --record-paths           Write the vertices, throughput and contributions of sampled paths to this\n"
+        << "                               binary log, which scripts/path_log.py converts to CSV or PLY\n"
+        << "      --record-every           Record 1 in every N paths (1000 by default)\n"
+        << "      --record-pixel           Record every path of the pixel X,Y instead. Can be given several times\n"
+        << "      --trace                  Write a timeline of the phases and tiles of the run to this file in the\n"
+        << "                               Chrome trace event format (for Perfetto or chrome://tracing)\n"
+        << "      --jobs                   Render every job of a JSON manifest. Each job is an object whose keys are\n"
+        << "                               long option names (plus 'output') applied on top of the other options\n"
+        << "      --serve                  Run a render server listening on this Unix socket. Requests are jobs\n"
+        << "                               (see --jobs) sent as one JSON line, optionally with a priority\n"
+        << "      --dataset                Render many configurations into a single dataset container (see\n"
+        << "                               src/dataset.hxx) instead of one image\n"
+        << "      --dataset-size           Number of configurations (halton) or points per axis (grid), 1000 by default\n"
+        << "      --dataset-sampling       How the parameters are sampled: halton (default) or grid\n"
+        << "      --dataset-elevation      Range of Sun elevations MIN:MAX in degrees (0:90 by default)\n"
+        << "      --dataset-turbidity      Range of turbidities MIN:MAX (1:5 by default)\n"
+        << "      --dataset-months         Range of months MIN:MAX (0:11 by default)\n"
+        << "      --dataset-aerosol-type   Aerosol type to include in the dataset. Can be repeated (all by default)\n"
+        << "      --spectral-basis         Render --spectral-samples wavelengths and write the spectrum of every pixel\n"
+        << "                               as this many polynomial basis coefficients (channels c00, c01...)\n"
+        << "      --spectral-range         Range of wavelengths MIN:MAX of the spectral basis (390:780 by default)\n"
+        << "      --spectral-samples       Number of wavelengths rendered for the spectral basis (40 by default)\n"
+        << "      --reconstruct            Reconstruct the image at --wavelength from a spectral basis EXR file\n"
+        << "      --no-symmetry            Render every pixel even if the sky is symmetric\n"
+        << "      --adaptive               Render a coarse grid and only refine where the sky is not smooth\n"
+        << "      --adaptive-step          Spacing in pixels of the initial adaptive grid, a power of two (16 by default)\n"
+        << "      --adaptive-threshold     Relative interpolation error that triggers a refinement (0.01 by default)\n"
+        << "      --error-map              Write the estimated error of every pixel to this EXR file (adaptive only)\n"
+        << "      --denoise                Denoise the image after rendering\n"
+        << "      --denoise-radius         Radius in pixels of the denoiser search window (8 by default)\n"
+        << "      --denoise-strength       Denoiser strength, higher values blur more (0.45 by default)\n"
+        << "      --features               Write the noisy image and the denoiser features to this EXR file\n"
+        << "      --cost                   Write the render time, null collisions and path length of every pixel to this EXR file\n"
         << "\n"
         << std::flush;
 }
@@ -191,17 +622,8 @@ CommandLineArguments::print_help(const char *arg0) const
 void
 CommandLineArguments::list_aerosol_types() const
 {
-    std::cerr
-        << "\nAvailable aerosol types (use with --aerosol-type)\n"
-        << "    none\n"
-        << "    background\n"
-        << "    desert-dust\n"
-        << "    maritime-clean\n"
-        << "    maritime-mineral\n"
-        << "    polar-antarctic\n"
-        << "    polar-artic\n"
-        << "    remote-continental\n"
-        << "    rural\n"
-        << "    urban\n"
-        << std::endl;
+    std::cerr << "\nAvailable aerosol types (use with --aerosol-type)\n";
+    for (const std::string &name : aerosol_type_names())
+        std::cerr << "    " << name << "\n";
+    std::cerr << std::endl;
 }
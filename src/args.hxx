@@ -23,6 +23,21 @@
 #define ARGS_HXX
 
 #include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Camera placement and output file of a single image. Batch renders have
+ * several of them sharing the same scene.
+ */
+struct CameraView {
+    int camera;
+    float eye_altitude;
+    float view_elevation;
+    float view_azimuth;
+    float fov;
+    std::string filename;
+};
 
 class CommandLineArguments final {
 public:
@@ -30,6 +45,19 @@ public:
 
     void parse_args(int argc, char **argv);
 
+    /**
+     * The view described by the main camera options and output filename.
+     */
+    CameraView main_view() const;
+
+    void print_help(const char *arg0) const;
+    void list_aerosol_types() const;
+
+    // --help and --list-aerosol-types stop the parsing. The caller prints
+    // the requested information instead of rendering.
+    bool help = false;
+    bool list_types = false;
+
     std::string filename = "out.exr";
     int width = 256;
     int height = 256;
@@ -39,6 +67,16 @@ public:
     int integrator = 0;
     int samples = 512;
     int camera = 1;
+    bool upper_hemisphere = false;
+    float horizon_exponent = 1.0f;
+    std::string jacobian_filename;
+    float view_elevation = 0.0f;
+    float view_azimuth = 0.0f;
+    float fov = 60.0f;
+    int crop_x = 0;
+    int crop_y = 0;
+    int crop_width = 0;
+    int crop_height = 0;
     int atmospheric_model = 0;
     std::string aerosol_type = "urban";
     float turbidity = 1.0f;
@@ -49,12 +87,77 @@ public:
     float sun_elevation = 0.0f;
     float sun_azimuth = 0.0f;
     float eye_altitude = 0.0f;
+    bool symmetry = true;
+    bool quiet = false;
+    // Progress output format (--progress), "bar" or "json", and seconds
+    // between updates
+    std::string progress_format = "bar";
+    float progress_interval = 1.0f;
+    // Prometheus textfile with the state of the render (--metrics)
+    std::string metrics_filename;
+    float metrics_interval = 15.0f;
+    // JSON report of the counters and timings of the run (--stats)
+    std::string stats_filename;
+    // Count hardware events while rendering (--perf-counters)
+    bool perf_counters = false;
+    // Log of sampled paths (--record-paths) and the paths it records: every
+    // path of record_pixels if not empty, otherwise 1 in record_every
+    std::string record_paths_filename;
+    int record_every = 1000;
+    std::vector<std::pair<int, int>> record_pixels;
+    // Chrome trace of the run (--trace)
+    std::string trace_filename;
+    // Additional views for batch rendering (--view). If not empty, the main
+    // view is not rendered.
+    std::vector<CameraView> views;
+    // Job manifest (--jobs). Each job is rendered with the options in
+    // base_args followed by its own options.
+    std::string jobs_filename;
+    std::vector<std::string> base_args;
+    // Unix socket of the render server (--serve)
+    std::string socket_path;
+    // EXR encoding of every output file
+    bool half_float = false;
+    std::string compression = "zip";
+    // Write the output tile by tile while rendering (--stream)
+    bool stream = false;
+    // Publish the framebuffer while rendering (--publish): "shm:NAME" for a
+    // POSIX shared memory segment, otherwise a file, named pipe or "-"
+    std::string publish_target;
+    float publish_interval = 1.0f;
+    // Directory of the render cache (--cache)
+    std::string cache_directory;
+    // Dataset container (--dataset) and the parameter space it samples
+    std::string dataset_filename;
+    int dataset_size = 1000;
+    std::string dataset_sampling = "halton";
+    float dataset_elevation[2] = {0.0f, 90.0f};
+    float dataset_turbidity[2] = {1.0f, 5.0f};
+    int dataset_months[2] = {0, 11};
+    // Empty means every aerosol type
+    std::vector<std::string> dataset_aerosol_types;
+    // Number of spectral basis coefficients to write (--spectral-basis), 0 to
+    // render a single wavelength
+    int spectral_basis = 0;
+    float spectral_range[2] = {390.0f, 780.0f};
+    int spectral_samples = 40;
+    // Spectral coefficients to reconstruct an image from (--reconstruct)
+    std::string reconstruct_filename;
+    bool adaptive = false;
+    int adaptive_step = 16;
+    float adaptive_threshold = 0.01f;
+    std::string error_map_filename;
+    bool denoise = false;
+    int denoise_radius = 8;
+    float denoise_strength = 0.45f;
+    std::string features_filename;
+    // Per-pixel render cost heatmaps (--cost)
+    std::string cost_filename;
 private:
     CommandLineArguments(const CommandLineArguments &) = delete;
     CommandLineArguments &operator=(const CommandLineArguments &) = delete;
 
-    void print_help(const char *arg0) const;
-    void list_aerosol_types() const;
+    CameraView parse_view(const std::string &spec) const;
 };
 
 #endif // ARGS_HXX
@@ -371,6 +371,24 @@ static const std::array<float, 12> ozone_mean_monthly_dobson = {
 
 } // anonymous namespace
 
+const std::vector<std::string> &
+aerosol_type_names()
+{
+    static const std::vector<std::string> names = {
+        "none",
+        "background",
+        "desert-dust",
+        "maritime-clean",
+        "maritime-mineral",
+        "polar-antarctic",
+        "polar-artic",
+        "remote-continental",
+        "rural",
+        "urban",
+    };
+    return names;
+}
+
 GuimeraAtmosphere::GuimeraAtmosphere(int month, float turbidity,
                                      const std::string &aerosol_type) :
     _month(month)
@@ -22,7 +22,12 @@
 #ifndef ATMOSPHERE_HXX
 #define ATMOSPHERE_HXX
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "aerosol.hxx"
 #include "common.hxx"
@@ -39,17 +44,18 @@ public:
     virtual float get_extinction(float height, float wl) const = 0;
 
     virtual float get_max_extinction(float wl) const {
-        // Cache the result
-        static float prev_wl = 0.0f;
-        static float prev_max_extinction = 0.0f;
-        if (prev_wl == wl) {
-            return prev_max_extinction;
+        // Cache the result. The wavelength and the extinction are packed in
+        // a single word so that the cache is safe to share between threads.
+        uint64_t cached = _max_extinction_cache.load(std::memory_order_relaxed);
+        if (bits_to_float(uint32_t(cached >> 32)) == wl) {
+            return bits_to_float(uint32_t(cached));
         }
 
         // Assume that the maximum extinction is at ground level
         float max_extinction = get_extinction(0.0f, wl);
-        prev_wl = wl;
-        prev_max_extinction = max_extinction;
+        _max_extinction_cache.store(
+            (uint64_t(float_to_bits(wl)) << 32) | float_to_bits(max_extinction),
+            std::memory_order_relaxed);
         return max_extinction;
     }
 
@@ -76,8 +82,24 @@ protected:
     float height_at_point(const glm::vec3 &p) const {
         return glm::distance(p, EARTH_CENTER) - EARTH_RADIUS;
     }
+private:
+    static uint32_t float_to_bits(float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+    static float bits_to_float(uint32_t bits) {
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    mutable std::atomic<uint64_t> _max_extinction_cache{0};
 };
 
+// Names accepted by GuimeraAtmosphere (and --aerosol-type)
+const std::vector<std::string> &aerosol_type_names();
+
 class GuimeraAtmosphere final : public Atmosphere {
 public:
     GuimeraAtmosphere(int month, float turbidity,
@@ -0,0 +1,118 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "batch.hxx"
+
+#include <iostream>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include "args.hxx"
+#include "progress.hxx"
+#include "sampler.hxx"
+#include "stats.hxx"
+
+BatchRenderer::BatchRenderer(const CommandLineArguments &args) :
+    _denoise(args.denoise),
+    _progress_format(ProgressReporter::parse_format(args.progress_format)),
+    _progress_interval(args.progress_interval)
+{
+    if (args.stream)
+        throw std::runtime_error("Streaming output is not supported when "
+                                 "rendering several views");
+    if (!args.publish_target.empty())
+        throw std::runtime_error("Frames cannot be published when rendering "
+                                 "several views");
+    if (!args.jacobian_filename.empty() || !args.error_map_filename.empty() ||
+        !args.features_filename.empty() || !args.cost_filename.empty()) {
+        std::cerr << "Auxiliary outputs are not written when rendering several views\n";
+    }
+    for (const CameraView &view : args.views) {
+        const Scene *shared_scene =
+            _renderers.empty() ? nullptr : _renderers.front()->scene();
+        _renderers.push_back(
+            std::make_unique<Renderer>(args, view, shared_scene));
+        _filenames.push_back(view.filename);
+    }
+}
+
+void
+BatchRenderer::render()
+{
+    // Interleave the tiles of every view. Adaptive renders synchronize after
+    // every level of the quadtree, so they are rendered afterwards one by one.
+    std::vector<std::pair<Renderer *, const Renderer::Tile *>> work;
+    size_t max_tiles = 0;
+    for (const auto &renderer : _renderers) {
+        if (!renderer->is_adaptive())
+            max_tiles = std::max(max_tiles, renderer->tiles().size());
+    }
+    for (size_t i = 0; i < max_tiles; ++i) {
+        for (const auto &renderer : _renderers) {
+            if (!renderer->is_adaptive() && i < renderer->tiles().size())
+                work.push_back({renderer.get(), &renderer->tiles()[i]});
+        }
+    }
+
+    std::cerr << "Rendering " << _renderers.size() << " views\n";
+
+    std::unique_ptr<ProgressReporter> progress;
+
+    auto kernel = [&](const tbb::blocked_range<size_t> &range) {
+        Sampler sampler(range.begin(), range.end());
+        const RenderCounters &counters = thread_counters();
+        for (size_t i = range.begin(); i < range.end(); ++i) {
+            uint64_t camera_rays = counters.camera_rays;
+            int64_t samples =
+                work[i].first->render_tile(&sampler, *work[i].second);
+            progress->add(1, samples, counters.camera_rays - camera_rays);
+        }
+    };
+
+    if (!work.empty()) {
+        progress = std::make_unique<ProgressReporter>(
+            _progress_format, _progress_interval, work.size());
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, work.size()), kernel);
+        progress->finish();
+    }
+    for (const auto &renderer : _renderers) {
+        if (!renderer->is_adaptive())
+            renderer->finish_render();
+    }
+
+    for (const auto &renderer : _renderers) {
+        if (renderer->is_adaptive())
+            renderer->render();
+    }
+
+    if (_denoise) {
+        for (const auto &renderer : _renderers)
+            renderer->denoise();
+    }
+}
+
+void
+BatchRenderer::write()
+{
+    for (size_t i = 0; i < _renderers.size(); ++i)
+        _renderers[i]->write(_filenames[i]);
+}
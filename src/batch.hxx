@@ -0,0 +1,53 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef BATCH_HXX
+#define BATCH_HXX
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "renderer.hxx"
+
+class CommandLineArguments;
+
+/**
+ * Render several views of the same scene in one go. The atmosphere,
+ * integrator and light source are shared by all the views, and the tiles of
+ * every view are interleaved in a single parallel loop so that no core idles
+ * between views.
+ */
+class BatchRenderer final {
+public:
+    BatchRenderer(const CommandLineArguments &args);
+
+    void render();
+    void write();
+private:
+    std::vector<std::unique_ptr<Renderer>> _renderers;
+    std::vector<std::string> _filenames;
+    bool _denoise;
+    ProgressReporter::Format _progress_format;
+    float _progress_interval;
+};
+
+#endif // BATCH_HXX
@@ -0,0 +1,286 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "cache.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "args.hxx"
+#include "exr.hxx"
+#include "renderer.hxx"
+
+namespace {
+
+// Bump whenever a change to the renderer changes its results, so that stale
+// entries are not reused.
+const int CACHE_VERSION = 2;
+
+/**
+ * Whether changing the Sun azimuth can be done by shifting the columns of the
+ * image. A crop window would need pixels outside of it.
+ */
+bool
+is_rotatable(const CommandLineArguments &args)
+{
+    return args.camera == 0 && (args.crop_width <= 0 || args.crop_height <= 0);
+}
+
+/**
+ * Canonical description of every option that affects the expected value of
+ * the image. The sample count is left out so entries can be topped up.
+ */
+std::string
+cache_key(const CommandLineArguments &args)
+{
+    std::ostringstream key;
+    key << std::setprecision(9)
+        << "version=" << CACHE_VERSION
+        << ";width=" << args.width
+        << ";height=" << args.height
+        << ";wavelength=" << args.wavelength
+        << ";integrator=" << args.integrator
+        << ";camera=" << args.camera
+        << ";upper_hemisphere=" << args.upper_hemisphere
+        << ";horizon_exponent=" << args.horizon_exponent
+        << ";view_elevation=" << args.view_elevation
+        << ";view_azimuth=" << args.view_azimuth
+        << ";fov=" << args.fov
+        << ";crop=" << args.crop_x << "," << args.crop_y << ","
+        << args.crop_width << "," << args.crop_height
+        << ";atmospheric_model=" << args.atmospheric_model
+        << ";aerosol_type=" << args.aerosol_type
+        << ";turbidity=" << args.turbidity
+        << ";month=" << args.month
+        << ";max_order=" << args.max_order
+        << ";only_ms=" << args.only_ms
+        << ";albedo=" << args.albedo
+        << ";sun_elevation=" << args.sun_elevation
+        << ";eye_altitude=" << args.eye_altitude
+        << ";adaptive=" << args.adaptive;
+    if (args.adaptive) {
+        key << ";adaptive_step=" << args.adaptive_step
+            << ";adaptive_threshold=" << args.adaptive_threshold;
+    }
+    if (is_rotatable(args)) {
+        // Only the position of the Sun within a column matters
+        float columns = args.sun_azimuth / 360.0f * args.width;
+        float phase = roundf((columns - floorf(columns)) * 1000.0f) / 1000.0f;
+        if (phase >= 1.0f)
+            phase = 0.0f;
+        key << ";azimuth_phase=" << std::fixed << std::setprecision(3) << phase;
+    } else {
+        key << ";sun_azimuth=" << args.sun_azimuth;
+    }
+    return key.str();
+}
+
+// 64-bit FNV-1a hash as a hexadecimal string
+std::string
+hash_string(const std::string &text)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    return hex;
+}
+
+/**
+ * Shift the columns of an equirectangular image so the Sun moves from
+ * from_azimuth to to_azimuth.
+ */
+void
+rotate_columns(std::vector<float> &image, int width, int height,
+               float from_azimuth, float to_azimuth)
+{
+    int shift = int(roundf((to_azimuth - from_azimuth) / 360.0f * width));
+    shift = ((shift % width) + width) % width;
+    if (shift == 0)
+        return;
+    std::vector<float> rotated(image.size());
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            rotated[size_t(y) * width + (x + shift) % width] =
+                image[size_t(y) * width + x];
+    image.swap(rotated);
+}
+
+} // anonymous namespace
+
+RenderCache::RenderCache(const std::string &directory) :
+    _directory(directory)
+{
+    std::filesystem::create_directories(_directory);
+}
+
+void
+RenderCache::render(Renderer &renderer, const CommandLineArguments &args)
+{
+    std::string key = cache_key(args);
+    int width = renderer.window().width();
+    int height = renderer.window().height();
+
+    Entry cached;
+    bool hit = load(key, width, height, cached);
+    if (hit && cached.sun_azimuth != args.sun_azimuth) {
+        rotate_columns(cached.pixels, width, height, cached.sun_azimuth,
+                       args.sun_azimuth);
+        rotate_columns(cached.variance, width, height, cached.sun_azimuth,
+                       args.sun_azimuth);
+    }
+
+    if (hit && cached.samples >= args.samples) {
+        if (!args.quiet)
+            std::cerr << "Using cached render (" << cached.samples
+                      << " samples per pixel)\n";
+        renderer.set_pixels(std::move(cached.pixels),
+                            std::move(cached.variance));
+        return;
+    }
+
+    // The pixels of an adaptive render are not all estimated with the same
+    // number of samples, so they cannot be merged.
+    bool top_up = hit && !args.adaptive;
+    if (top_up) {
+        if (!args.quiet)
+            std::cerr << "Adding " << args.samples - cached.samples
+                      << " samples per pixel to a cached render with "
+                      << cached.samples << "\n";
+        renderer.set_samples_per_pixel(args.samples - cached.samples);
+        // The seeds of previous renders of this entry are all below its
+        // sample count.
+        renderer.set_seed(cached.samples);
+    }
+    renderer.render();
+    renderer.set_samples_per_pixel(args.samples);
+    renderer.set_seed(0);
+    if (renderer.cancelled())
+        return;
+
+    Entry result;
+    result.samples = args.samples;
+    result.sun_azimuth = args.sun_azimuth;
+    result.pixels = renderer.buffer();
+    result.variance = renderer.variance();
+    if (top_up) {
+        // Weighted mean of both estimates. The variances are those of the
+        // pixel estimates, so they are weighted by the squared sample counts.
+        float n0 = cached.samples;
+        float n1 = args.samples - cached.samples;
+        float n = n0 + n1;
+        for (size_t i = 0; i < result.pixels.size(); ++i) {
+            result.pixels[i] = (n0 * cached.pixels[i] + n1 * result.pixels[i]) / n;
+            result.variance[i] = (n0 * n0 * cached.variance[i]
+                                  + n1 * n1 * result.variance[i]) / (n * n);
+        }
+        renderer.set_pixels(result.pixels, result.variance);
+    }
+    store(key, width, height, result);
+}
+
+bool
+RenderCache::load(const std::string &key, int width, int height,
+                  Entry &entry) const
+{
+    int stored_width, stored_height;
+    std::vector<std::vector<float>> channels;
+    ExrAttributes attributes;
+    if (!load_exr_channels(path(key), stored_width, stored_height,
+                           {"Y", "variance"}, channels, &attributes)
+        || stored_width != width || stored_height != height)
+        return false;
+    // Guard against hash collisions
+    if (attributes["cacheKey"] != key)
+        return false;
+    std::istringstream(attributes["cacheSamples"]) >> entry.samples;
+    std::istringstream(attributes["cacheSunAzimuth"]) >> entry.sun_azimuth;
+    if (entry.samples <= 0)
+        return false;
+    entry.pixels = std::move(channels[0]);
+    entry.variance = std::move(channels[1]);
+    return true;
+}
+
+void
+RenderCache::store(const std::string &key, int width, int height,
+                   const Entry &entry) const
+{
+    // The metadata is stored in the header of the image, so an entry is a
+    // single file. It is written to a temporary file with a name unique to
+    // this process and renamed, so that concurrent renders never see a
+    // partial entry.
+    static std::atomic<unsigned> counter{0};
+    std::string filename = path(key);
+    std::string tmp = filename + "." + std::to_string(getpid()) + "."
+                      + std::to_string(counter++) + ".tmp";
+
+    std::ostringstream sun_azimuth;
+    sun_azimuth << std::setprecision(9) << entry.sun_azimuth;
+    ExrAttributes attributes = {
+        {"cacheKey", key},
+        {"cacheSamples", std::to_string(entry.samples)},
+        {"cacheSunAzimuth", sun_azimuth.str()},
+    };
+    if (!save_exr_channels(tmp, width, height,
+                           {{"Y", entry.pixels.data()},
+                            {"variance", entry.variance.data()}},
+                           ExrOptions(), nullptr, &attributes))
+        return;
+    std::error_code error;
+    std::filesystem::rename(tmp, filename, error);
+    if (error) {
+        std::cerr << "Failed to update the render cache entry " << filename
+                  << ": " << error.message() << "\n";
+        std::filesystem::remove(tmp, error);
+    }
+}
+
+std::string
+RenderCache::path(const std::string &key) const
+{
+    return (std::filesystem::path(_directory) / (hash_string(key) + ".exr"))
+        .string();
+}
+
+void
+render_cached(Renderer &renderer, const CommandLineArguments &args)
+{
+    // A cached image has no render cost to report
+    if (args.cache_directory.empty() || !args.cost_filename.empty()) {
+        renderer.render();
+        return;
+    }
+    RenderCache cache(args.cache_directory);
+    cache.render(renderer, args);
+}
@@ -0,0 +1,72 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef CACHE_HXX
+#define CACHE_HXX
+
+#include <string>
+#include <vector>
+
+class CommandLineArguments;
+class Renderer;
+
+/**
+ * On-disk render cache (--cache). Entries are keyed by a hash of every option
+ * that affects the rendered image, except the sample count, and store the
+ * image, the variance of every pixel and the number of samples in a single
+ * file <hash>.exr, with channels Y and variance and the full key, samples and
+ * Sun azimuth as header attributes.
+ *
+ * A request with at most as many samples as the entry is served from the
+ * cache. A request with more samples only renders the missing ones with a new
+ * seed and merges them into the entry. For equirectangular images, changing
+ * the Sun azimuth rotates the sky around the vertical axis, which is a shift
+ * of the columns, so entries that only differ by a whole number of columns
+ * share the same key.
+ */
+class RenderCache final {
+public:
+    RenderCache(const std::string &directory);
+
+    void render(Renderer &renderer, const CommandLineArguments &args);
+private:
+    struct Entry {
+        int samples = 0;
+        float sun_azimuth = 0.0f;
+        std::vector<float> pixels;
+        std::vector<float> variance;
+    };
+
+    bool load(const std::string &key, int width, int height, Entry &entry) const;
+    void store(const std::string &key, int width, int height,
+               const Entry &entry) const;
+    std::string path(const std::string &key) const;
+
+    std::string _directory;
+};
+
+/**
+ * Render using the cache in args.cache_directory, or simply render if there
+ * is none.
+ */
+void render_cached(Renderer &renderer, const CommandLineArguments &args);
+
+#endif // CACHE_HXX
@@ -21,36 +21,69 @@
 
 #include "camera.hxx"
 
+#include <stdexcept>
+
 using namespace glm;
 
-//#define MORE_TEXELS_TO_HORIZON
-//#define ONLY_RENDER_UPPER_HEMISPHERE
+EquirectangularCamera::EquirectangularCamera(float eye_altitude,
+                                             bool upper_hemisphere,
+                                             float horizon_exponent) :
+    _eye_altitude(eye_altitude),
+    _upper_hemisphere(upper_hemisphere),
+    _horizon_exponent(horizon_exponent)
+{
+    if (_horizon_exponent < 1.0f)
+        throw std::runtime_error("The horizon exponent must be >= 1");
+}
 
 bool
 EquirectangularCamera::sample_ray(Ray &ray, const glm::vec2 &uv)
 {
     float phi = M_TWO_PI * uv.x;
-#ifndef MORE_TEXELS_TO_HORIZON
-#ifndef ONLY_RENDER_UPPER_HEMISPHERE
-    float theta = M_PI * uv.y;
-#else
-    float theta = M_HALF_PI * uv.y;
-#endif
-#else
     // Apply a non-linear transformation to the elevation to dedicate more
     // texels to the horizon, which is where having more detail matters.
-#ifndef ONLY_RENDER_UPPER_HEMISPHERE
-    float l = uv.y * 2.0f - 1.0f;
-#else
-    float l = uv.y - 1.0f;
-#endif
-    float theta = l*l * sign(l) * M_PI * 0.5f + M_HALF_PI;
-#endif
+    // l is the signed distance to the horizon in [-1,1], so an exponent of 1
+    // gives the usual linear mapping.
+    float l = _upper_hemisphere ? uv.y - 1.0f : uv.y * 2.0f - 1.0f;
+    float theta = powf(fabsf(l), _horizon_exponent) * sign(l) * M_HALF_PI
+        + M_HALF_PI;
     ray.o = vec3(0.0f, 0.0f, _eye_altitude);
     ray.d = spherical_to_cartesian(theta, phi);
     return true;
 }
 
+bool
+EquirectangularCamera::direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const
+{
+    float theta = acosf(clamp(d.z, -1.0f, 1.0f));
+    if (_upper_hemisphere && theta > M_HALF_PI)
+        return false;
+    float phi = atan2f(d.y, d.x);
+    if (phi < 0.0f)
+        phi += M_TWO_PI;
+    float m = (theta - M_HALF_PI) / M_HALF_PI;
+    float l = powf(fabsf(m), 1.0f / _horizon_exponent) * sign(m);
+    uv.x = phi / M_TWO_PI;
+    uv.y = _upper_hemisphere ? l + 1.0f : (l + 1.0f) * 0.5f;
+    return true;
+}
+
+float
+EquirectangularCamera::jacobian(const glm::vec2 &uv) const
+{
+    float l = _upper_hemisphere ? uv.y - 1.0f : uv.y * 2.0f - 1.0f;
+    float theta = powf(fabsf(l), _horizon_exponent) * sign(l) * M_HALF_PI
+        + M_HALF_PI;
+    // d(theta)/d(v), taking into account the [0,1] -> [-1,1] remapping
+    float dtheta_dv = M_HALF_PI * _horizon_exponent
+        * powf(fabsf(l), _horizon_exponent - 1.0f)
+        * (_upper_hemisphere ? 1.0f : 2.0f);
+    // d(omega) = sin(theta) d(theta) d(phi), with d(phi)/d(u) = 2pi
+    return M_TWO_PI * sinf(theta) * dtheta_dv;
+}
+
+//------------------------------------------------------------------------------
+
 bool
 FisheyeCamera::sample_ray(Ray &ray, const glm::vec2 &uv_)
 {
@@ -70,3 +103,103 @@ FisheyeCamera::sample_ray(Ray &ray, const glm::vec2 &uv_)
     ray.d = spherical_to_cartesian(theta, phi);
     return true;
 }
+
+bool
+FisheyeCamera::direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const
+{
+    float theta = acosf(clamp(d.z, -1.0f, 1.0f));
+    if (theta > M_HALF_PI)
+        return false;
+    float phi = atan2f(d.y, d.x);
+    float l = theta * M_INV_PI;
+    uv = vec2(cosf(phi), sinf(phi)) * l;
+    if (_aspect_ratio < 1.0f) {
+        uv.y *= _aspect_ratio;
+    } else {
+        uv.x /= _aspect_ratio;
+    }
+    uv += vec2(0.5f);
+    return uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f;
+}
+
+float
+FisheyeCamera::jacobian(const glm::vec2 &uv_) const
+{
+    glm::vec2 uv = uv_;
+    uv -= 0.5f;
+    // Determinant of the aspect ratio correction
+    float det;
+    if (_aspect_ratio < 1.0f) {
+        uv.y *= 1.0f / _aspect_ratio;
+        det = 1.0f / _aspect_ratio;
+    } else {
+        uv.x *= _aspect_ratio;
+        det = _aspect_ratio;
+    }
+    float l = length(uv);
+    if (l > (0.5f + 1e-3f))
+        return 0.0f;
+    // Equidistant projection, theta = pi * l. In polar coordinates
+    // d(omega) = sin(theta) pi dl d(phi) and dA = l dl d(phi).
+    float theta = M_PI * l;
+    float sin_theta_over_l = l > 1e-6f ? sinf(theta) / l : M_PI;
+    return M_PI * sin_theta_over_l * det;
+}
+
+//------------------------------------------------------------------------------
+
+PerspectiveCamera::PerspectiveCamera(float eye_altitude, float view_elevation,
+                                     float view_azimuth, float fov,
+                                     float aspect_ratio) :
+    _eye_altitude(eye_altitude),
+    _aspect_ratio(aspect_ratio)
+{
+    if (fov <= 0.0f || fov >= 180.0f)
+        throw std::runtime_error("The field of view must be in (0,180) degrees");
+    _tan_half_fov = tanf(radians(fov) * 0.5f);
+    float elevation = radians(view_elevation);
+    float azimuth = radians(view_azimuth);
+    _forward = vec3(cosf(azimuth) * cosf(elevation),
+                    sinf(azimuth) * cosf(elevation),
+                    sinf(elevation));
+    // Keep the horizon level. This is well defined even when looking straight
+    // up or down.
+    _right = vec3(sinf(azimuth), -cosf(azimuth), 0.0f);
+    _up = cross(_right, _forward);
+}
+
+bool
+PerspectiveCamera::sample_ray(Ray &ray, const glm::vec2 &uv)
+{
+    // The first row of the image is the top one
+    float x = (uv.x * 2.0f - 1.0f) * _tan_half_fov * _aspect_ratio;
+    float y = (1.0f - uv.y * 2.0f) * _tan_half_fov;
+    ray.o = vec3(0.0f, 0.0f, _eye_altitude);
+    ray.d = normalize(_forward + _right * x + _up * y);
+    return true;
+}
+
+bool
+PerspectiveCamera::direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const
+{
+    float z = dot(d, _forward);
+    if (z <= 0.0f)
+        return false;
+    float x = dot(d, _right) / z;
+    float y = dot(d, _up) / z;
+    uv.x = (x / (_tan_half_fov * _aspect_ratio) + 1.0f) * 0.5f;
+    uv.y = (1.0f - y / _tan_half_fov) * 0.5f;
+    return uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f;
+}
+
+float
+PerspectiveCamera::jacobian(const glm::vec2 &uv) const
+{
+    float x = (uv.x * 2.0f - 1.0f) * _tan_half_fov * _aspect_ratio;
+    float y = (1.0f - uv.y * 2.0f) * _tan_half_fov;
+    // Area of the image plane at distance 1 per unit of uv area, times
+    // d(omega)/dA = cos^3(theta) on that plane.
+    float plane_area = 4.0f * _tan_half_fov * _tan_half_fov * _aspect_ratio;
+    float r2 = 1.0f + x*x + y*y;
+    return plane_area / (r2 * sqrtf(r2));
+}
@@ -27,14 +27,37 @@
 class Camera {
 public:
     virtual bool sample_ray(Ray &ray, const glm::vec2 &uv) = 0;
+    /**
+     * Inverse of sample_ray. Map a world space direction to the normalized
+     * image coordinates [0,1] that see it. Return false if the direction is
+     * not covered by the camera.
+     */
+    virtual bool direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const = 0;
+    /**
+     * Solid angle (in steradians) covered by a unit area of normalized image
+     * coordinates around uv, i.e. |d(omega) / d(u,v)|. 0 if uv is not mapped
+     * to any direction.
+     */
+    virtual float jacobian(const glm::vec2 &uv) const = 0;
 };
 
 class EquirectangularCamera final : public Camera {
 public:
-    EquirectangularCamera(float eye_altitude) : _eye_altitude(eye_altitude) {}
+    /**
+     * If upper_hemisphere is true, only directions above the horizon are
+     * mapped to the image. horizon_exponent controls the non-linear mapping of
+     * the elevation: 1 is a linear mapping and higher values dedicate more
+     * texels to the horizon.
+     */
+    EquirectangularCamera(float eye_altitude, bool upper_hemisphere = false,
+                          float horizon_exponent = 1.0f);
     virtual bool sample_ray(Ray &ray, const glm::vec2 &uv);
+    virtual bool direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const;
+    virtual float jacobian(const glm::vec2 &uv) const;
 private:
     float _eye_altitude;
+    bool _upper_hemisphere;
+    float _horizon_exponent;
 };
 
 class FisheyeCamera final : public Camera {
@@ -43,9 +66,30 @@ public:
         _eye_altitude(eye_altitude),
         _aspect_ratio(aspect_ratio) {}
     virtual bool sample_ray(Ray &ray, const glm::vec2 &uv);
+    virtual bool direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const;
+    virtual float jacobian(const glm::vec2 &uv) const;
 private:
     float _eye_altitude;
     float _aspect_ratio;
 };
 
+class PerspectiveCamera final : public Camera {
+public:
+    /**
+     * Pinhole camera looking at the direction given by an elevation and an
+     * azimuth in degrees (same convention as the Sun). fov is the vertical
+     * field of view in degrees.
+     */
+    PerspectiveCamera(float eye_altitude, float view_elevation,
+                      float view_azimuth, float fov, float aspect_ratio);
+    virtual bool sample_ray(Ray &ray, const glm::vec2 &uv);
+    virtual bool direction_to_uv(const glm::vec3 &d, glm::vec2 &uv) const;
+    virtual float jacobian(const glm::vec2 &uv) const;
+private:
+    float _eye_altitude;
+    float _aspect_ratio;
+    float _tan_half_fov;
+    glm::vec3 _forward, _right, _up;
+};
+
 #endif // CAMERA_HXX
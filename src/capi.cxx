@@ -0,0 +1,193 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "skytracer.h"
+
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "args.hxx"
+#include "renderer.hxx"
+
+struct skytracer_scene {
+    CommandLineArguments args;
+    std::unique_ptr<Renderer> renderer;
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+int
+fail(const std::exception &e)
+{
+    last_error = e.what();
+    return SKYTRACER_ERROR;
+}
+
+} // anonymous namespace
+
+int
+skytracer_api_version(void)
+{
+    return SKYTRACER_API_VERSION;
+}
+
+void
+skytracer_params_init(skytracer_params *params)
+{
+    // Keep the defaults in a single place. The aerosol type must outlive
+    // the parameters, hence the static arguments.
+    static const CommandLineArguments args;
+    params->struct_size = sizeof(skytracer_params);
+    params->width = args.width;
+    params->height = args.height;
+    params->samples = args.samples;
+    params->wavelength = args.wavelength;
+    params->integrator = args.integrator;
+    params->max_order = args.max_order;
+    params->only_ms = args.only_ms;
+    params->camera = args.camera;
+    params->upper_hemisphere = args.upper_hemisphere;
+    params->horizon_exponent = args.horizon_exponent;
+    params->view_elevation = args.view_elevation;
+    params->view_azimuth = args.view_azimuth;
+    params->fov = args.fov;
+    params->eye_altitude = args.eye_altitude;
+    params->atmospheric_model = args.atmospheric_model;
+    params->aerosol_type = args.aerosol_type.c_str();
+    params->turbidity = args.turbidity;
+    params->month = args.month;
+    params->albedo = args.albedo;
+    params->sun_elevation = args.sun_elevation;
+    params->sun_azimuth = args.sun_azimuth;
+}
+
+skytracer_scene *
+skytracer_scene_create(const skytracer_params *caller_params)
+{
+    try {
+        // Parameters of older callers are a prefix of the current ones
+        if (caller_params->struct_size < sizeof(size_t)
+            || caller_params->struct_size > sizeof(skytracer_params))
+            throw std::runtime_error("Invalid skytracer_params size, call "
+                                     "skytracer_params_init() first");
+        skytracer_params defaults;
+        skytracer_params_init(&defaults);
+        memcpy(&defaults, caller_params, caller_params->struct_size);
+        const skytracer_params *params = &defaults;
+
+        auto scene = std::make_unique<skytracer_scene>();
+        CommandLineArguments &args = scene->args;
+        args.width = params->width;
+        args.height = params->height;
+        args.samples = params->samples;
+        args.wavelength = params->wavelength;
+        args.integrator = params->integrator;
+        args.max_order = params->max_order;
+        args.only_ms = params->only_ms != 0;
+        args.camera = params->camera;
+        args.upper_hemisphere = params->upper_hemisphere != 0;
+        args.horizon_exponent = params->horizon_exponent;
+        args.view_elevation = params->view_elevation;
+        args.view_azimuth = params->view_azimuth;
+        args.fov = params->fov;
+        args.eye_altitude = params->eye_altitude;
+        args.atmospheric_model = params->atmospheric_model;
+        if (params->aerosol_type)
+            args.aerosol_type = params->aerosol_type;
+        args.turbidity = params->turbidity;
+        args.month = params->month;
+        args.albedo = params->albedo;
+        args.sun_elevation = params->sun_elevation;
+        args.sun_azimuth = params->sun_azimuth;
+        args.quiet = true;
+        if (args.width <= 0 || args.height <= 0 || args.samples <= 0)
+            throw std::runtime_error("Invalid image size or sample count");
+        scene->renderer = std::make_unique<Renderer>(args);
+        return scene.release();
+    } catch (const std::exception &e) {
+        fail(e);
+        return nullptr;
+    }
+}
+
+void
+skytracer_scene_destroy(skytracer_scene *scene)
+{
+    delete scene;
+}
+
+int
+skytracer_render(skytracer_scene *scene, float *buffer)
+{
+    try {
+        Renderer &renderer = *scene->renderer;
+        renderer.render();
+        // Take the framebuffer so that it is freed once copied. A scene
+        // waiting between renders then holds no copy of the image.
+        std::vector<float> pixels = renderer.take_buffer();
+        if (renderer.cancelled())
+            return SKYTRACER_CANCELLED;
+        memcpy(buffer, pixels.data(), pixels.size() * sizeof(float));
+        return SKYTRACER_OK;
+    } catch (const std::exception &e) {
+        return fail(e);
+    }
+}
+
+int
+skytracer_render_directions(skytracer_scene *scene, const float *directions,
+                            size_t count, float *radiance)
+{
+    try {
+        std::vector<glm::vec3> dirs(count);
+        for (size_t i = 0; i < count; ++i)
+            dirs[i] = glm::vec3(directions[3 * i], directions[3 * i + 1],
+                                directions[3 * i + 2]);
+        scene->renderer->render_directions(dirs.data(), count, radiance);
+        return SKYTRACER_OK;
+    } catch (const std::exception &e) {
+        return fail(e);
+    }
+}
+
+void
+skytracer_cancel(skytracer_scene *scene)
+{
+    scene->renderer->cancel();
+}
+
+float
+skytracer_progress(const skytracer_scene *scene)
+{
+    return scene->renderer->progress();
+}
+
+const char *
+skytracer_last_error(void)
+{
+    return last_error.c_str();
+}
@@ -0,0 +1,290 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "dataset.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "args.hxx"
+#include "atmosphere.hxx"
+#include "json.hxx"
+#include "progress.hxx"
+#include "renderer.hxx"
+
+static_assert(sizeof(DatasetHeader) == 64, "Unexpected dataset header size");
+
+namespace {
+
+// Van der Corput radical inverse of index in the given base
+float
+radical_inverse(uint64_t index, uint64_t base)
+{
+    double inv_base = 1.0 / base, factor = inv_base, result = 0.0;
+    while (index > 0) {
+        result += (index % base) * factor;
+        index /= base;
+        factor *= inv_base;
+    }
+    return float(result);
+}
+
+float
+lerp(const float range[2], float t)
+{
+    return range[0] + (range[1] - range[0]) * t;
+}
+
+void
+write_at(int fd, const void *data, size_t size, uint64_t offset)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t count = pwrite(fd, bytes, size, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            throw std::runtime_error(std::string("Could not write the dataset: ")
+                                     + strerror(errno));
+        bytes += count;
+        size -= count;
+        offset += count;
+    }
+}
+
+} // anonymous namespace
+
+DatasetGenerator::DatasetGenerator(const CommandLineArguments &args) :
+    _args(args),
+    _aerosol_types(args.dataset_aerosol_types)
+{
+    if (args.stream || !args.publish_target.empty() || !args.views.empty())
+        throw std::runtime_error("Datasets cannot be combined with streaming, "
+                                 "published frames or several views");
+    // These options apply to single images. Every record would otherwise
+    // export its own metrics or compute outputs that are never written.
+    if (!args.metrics_filename.empty() || !args.cache_directory.empty()
+        || !args.cost_filename.empty() || !args.features_filename.empty()
+        || !args.jacobian_filename.empty() || !args.error_map_filename.empty()
+        || args.spectral_basis > 0)
+        throw std::runtime_error("Datasets cannot be combined with metrics, "
+                                 "the render cache, cost maps, features, "
+                                 "Jacobians, error maps or spectral bases");
+    if (args.dataset_size < 1)
+        throw std::runtime_error("The dataset size must be at least 1");
+    if (args.dataset_months[0] < 0 || args.dataset_months[1] > 11)
+        throw std::runtime_error("The dataset months must be between 0 and 11");
+    const std::vector<std::string> &known = aerosol_type_names();
+    if (_aerosol_types.empty())
+        _aerosol_types = known;
+    for (const std::string &type : _aerosol_types) {
+        if (std::find(known.begin(), known.end(), type) == known.end())
+            throw std::runtime_error("Unknown aerosol type '" + type + "'");
+    }
+
+    if (args.dataset_sampling == "halton")
+        sample_halton();
+    else if (args.dataset_sampling == "grid")
+        sample_grid();
+    else
+        throw std::runtime_error("Unknown dataset sampling '"
+                                 + args.dataset_sampling + "'");
+}
+
+void
+DatasetGenerator::sample_halton()
+{
+    int months = _args.dataset_months[1] - _args.dataset_months[0] + 1;
+    int aerosols = _aerosol_types.size();
+    // Skip index 0, which is the origin in every dimension
+    for (int i = 1; i <= _args.dataset_size; ++i) {
+        Configuration c;
+        c.sun_elevation = lerp(_args.dataset_elevation, radical_inverse(i, 2));
+        c.turbidity = lerp(_args.dataset_turbidity, radical_inverse(i, 3));
+        c.month = _args.dataset_months[0]
+            + std::min(int(radical_inverse(i, 5) * months), months - 1);
+        c.aerosol = std::min(int(radical_inverse(i, 7) * aerosols), aerosols - 1);
+        _configurations.push_back(c);
+    }
+}
+
+void
+DatasetGenerator::sample_grid()
+{
+    // dataset_size points along the continuous axes, every month and aerosol
+    int n = _args.dataset_size;
+    for (int aerosol = 0; aerosol < int(_aerosol_types.size()); ++aerosol) {
+        for (int month = _args.dataset_months[0];
+             month <= _args.dataset_months[1]; ++month) {
+            for (int t = 0; t < n; ++t) {
+                for (int e = 0; e < n; ++e) {
+                    float te = n > 1 ? float(e) / (n - 1) : 0.0f;
+                    float tt = n > 1 ? float(t) / (n - 1) : 0.0f;
+                    _configurations.push_back(Configuration{
+                        lerp(_args.dataset_elevation, te),
+                        lerp(_args.dataset_turbidity, tt), month, aerosol});
+                }
+            }
+        }
+    }
+}
+
+std::string
+DatasetGenerator::description() const
+{
+    std::string json = "{\"parameters\":[\"sun_elevation\",\"turbidity\","
+        "\"month\",\"aerosol_type\"],\"aerosol_types\":[";
+    for (size_t i = 0; i < _aerosol_types.size(); ++i)
+        json += (i > 0 ? "," : "") + json_quote(_aerosol_types[i]);
+    json += "],\"sampling\":" + json_quote(_args.dataset_sampling) + "}";
+    return json;
+}
+
+void
+DatasetGenerator::run()
+{
+    using namespace std::chrono;
+
+    const std::string &filename = _args.dataset_filename;
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + filename + ": "
+                                 + strerror(errno));
+
+    // Every record holds the rendered window, which may be cropped
+    bool cropped = _args.crop_width > 0 && _args.crop_height > 0;
+    DatasetHeader header = {};
+    header.width = cropped ? _args.crop_width : _args.width;
+    header.height = cropped ? _args.crop_height : _args.height;
+    memcpy(header.magic, "SKYDSET", 8);
+    header.version = 1;
+    header.parameter_count = 4;
+    header.record_count = 0;
+    header.record_size = PARAMETERS_SIZE
+        + size_t(header.width) * header.height * sizeof(float);
+    header.record_size = (header.record_size + 63) / 64 * 64;
+    header.data_offset = DATA_OFFSET;
+    header.wavelength = _args.wavelength;
+    header.samples = _args.samples;
+
+    std::string json = description();
+    if (sizeof(header) + json.size() + 1 > DATA_OFFSET) {
+        close(fd);
+        throw std::runtime_error("The dataset description is too long");
+    }
+    size_t count = _configurations.size();
+    try {
+        write_at(fd, &header, sizeof(header), 0);
+        write_at(fd, json.c_str(), json.size() + 1, sizeof(header));
+        // Reserve the whole file so that it can be mapped while rendering
+        if (ftruncate(fd, DATA_OFFSET + count * header.record_size) < 0)
+            throw std::runtime_error(std::string("Could not resize the dataset: ")
+                                     + strerror(errno));
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+
+    std::cerr << "Rendering a dataset of " << count << " images\n";
+    auto start = steady_clock::now();
+
+    // Records are rendered in parallel and in any order. record_count only
+    // grows when every record before it is complete.
+    std::mutex progress_mutex;
+    std::vector<bool> done(count, false);
+    size_t done_count = 0;
+    std::atomic<bool> failed{false};
+    std::string error;
+    update_progress_bar(0, count);
+
+    tbb::parallel_for(size_t(0), count, [&](size_t i) {
+        if (failed)
+            return;
+        try {
+            // Same options as the dataset, plus the sampled parameters
+            const Configuration &c = _configurations[i];
+            std::vector<std::string> options = {"skytracer"};
+            options.insert(options.end(), _args.base_args.begin(),
+                           _args.base_args.end());
+            options.insert(options.end(), {
+                "--elevation", std::to_string(c.sun_elevation),
+                "--turbidity", std::to_string(c.turbidity),
+                "--month", std::to_string(c.month),
+                "--aerosol-type", _aerosol_types[c.aerosol],
+                "--quiet"});
+            std::vector<char *> argv;
+            for (std::string &option : options)
+                argv.push_back(option.data());
+            CommandLineArguments args;
+            args.parse_args(argv.size(), argv.data());
+
+            Renderer renderer(args);
+            // Decorrelate the noise of the images
+            renderer.set_seed(i);
+            renderer.render();
+            if (args.denoise)
+                renderer.denoise();
+
+            float parameters[PARAMETERS_SIZE / sizeof(float)] = {
+                args.sun_elevation, args.turbidity, float(args.month),
+                float(c.aerosol)};
+            uint64_t offset = DATA_OFFSET + i * header.record_size;
+            write_at(fd, parameters, sizeof(parameters), offset);
+            write_at(fd, renderer.buffer().data(),
+                     renderer.buffer().size() * sizeof(float),
+                     offset + PARAMETERS_SIZE);
+
+            std::scoped_lock lock(progress_mutex);
+            done[i] = true;
+            uint64_t complete = header.record_count;
+            while (complete < count && done[complete])
+                ++complete;
+            if (complete != header.record_count) {
+                header.record_count = complete;
+                write_at(fd, &header.record_count, sizeof(header.record_count),
+                         offsetof(DatasetHeader, record_count));
+            }
+            update_progress_bar(++done_count, count);
+        } catch (const std::exception &e) {
+            std::scoped_lock lock(progress_mutex);
+            if (!failed.exchange(true))
+                error = e.what();
+        }
+    });
+    close(fd);
+    if (failed)
+        throw std::runtime_error(error);
+
+    print_elapsed_time(steady_clock::now() - start);
+    std::cerr << "Saved dataset [ " << filename << " ] (" << count
+              << " images of " << header.width << "x" << header.height << ")\n";
+}
@@ -0,0 +1,87 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef DATASET_HXX
+#define DATASET_HXX
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CommandLineArguments;
+
+/**
+ * Header at the start of a dataset container.
+ *
+ * The container is meant to be memory-mapped: record i starts at
+ * data_offset + i * record_size and holds parameter_count floats (Sun
+ * elevation, turbidity, month and the index of the aerosol type), padded to
+ * PARAMETERS_SIZE bytes, followed by the width x height pixels as floats,
+ * row by row. Only the first record_count records are complete. Right after
+ * the header there is a null-terminated JSON object that names the
+ * parameters and lists the aerosol types.
+ */
+struct DatasetHeader {
+    char magic[8];            // "SKYDSET\0"
+    uint32_t version;         // 1
+    uint32_t width;
+    uint32_t height;
+    uint32_t parameter_count;
+    uint64_t record_count;
+    uint64_t record_size;
+    uint64_t data_offset;
+    float wavelength;
+    uint32_t samples;
+    uint32_t reserved[2];
+};
+
+/**
+ * Renders many small images that sample the space of Sun elevations,
+ * turbidities, months and aerosol types (--dataset) and appends them to a
+ * single container, e.g. to train models of the sky. The other options are
+ * shared by every image.
+ */
+class DatasetGenerator final {
+public:
+    static const size_t DATA_OFFSET = 4096;
+    static const size_t PARAMETERS_SIZE = 64;
+
+    DatasetGenerator(const CommandLineArguments &args);
+
+    void run();
+private:
+    struct Configuration {
+        float sun_elevation;
+        float turbidity;
+        int month;
+        int aerosol;
+    };
+
+    void sample_halton();
+    void sample_grid();
+    std::string description() const;
+
+    const CommandLineArguments &_args;
+    std::vector<std::string> _aerosol_types;
+    std::vector<Configuration> _configurations;
+};
+
+#endif // DATASET_HXX
@@ -0,0 +1,111 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "denoiser.hxx"
+
+#include <algorithm>
+#include <cmath>
+#include <tbb/parallel_for.h>
+
+namespace {
+
+// Half-size of the patches that are compared
+const int PATCH_RADIUS = 1;
+// Bandwidths of the feature weights
+const float ZENITH_SIGMA = 0.05f;        // radians
+const float OPTICAL_DEPTH_SIGMA = 0.1f;  // relative
+
+} // anonymous namespace
+
+Denoiser::Denoiser(int radius, float strength) :
+    _radius(radius),
+    _strength(strength)
+{
+}
+
+void
+Denoiser::denoise(const std::vector<float> &color,
+                  const FeatureBuffers &features,
+                  int width, int height,
+                  std::vector<float> &output) const
+{
+    output.resize(color.size());
+
+    const float k2 = _strength * _strength;
+    const float inv_zenith = 1.0f / (2.0f * ZENITH_SIGMA * ZENITH_SIGMA);
+    const float inv_depth = 1.0f / (2.0f * OPTICAL_DEPTH_SIGMA * OPTICAL_DEPTH_SIGMA);
+    const float patch_norm = 1.0f / ((2 * PATCH_RADIUS + 1) * (2 * PATCH_RADIUS + 1));
+
+    auto index = [width, height](int x, int y) {
+        x = std::clamp(x, 0, width - 1);
+        y = std::clamp(y, 0, height - 1);
+        return size_t(y) * width + x;
+    };
+
+    tbb::parallel_for(0, height, [&](int y) {
+        for (int x = 0; x < width; ++x) {
+            size_t p = index(x, y);
+            float zenith_p = features.view_zenith[p];
+            float depth_p = features.optical_depth[p];
+            float sum = 0.0f;
+            float sum_weights = 0.0f;
+            for (int qy = y - _radius; qy <= y + _radius; ++qy) {
+                if (qy < 0 || qy >= height)
+                    continue;
+                for (int qx = x - _radius; qx <= x + _radius; ++qx) {
+                    if (qx < 0 || qx >= width)
+                        continue;
+                    size_t q = index(qx, qy);
+
+                    // Feature distance
+                    float dz = features.view_zenith[q] - zenith_p;
+                    float dd = (features.optical_depth[q] - depth_p)
+                        / (std::max(features.optical_depth[q], depth_p) + 1e-4f);
+                    float feature_distance = dz * dz * inv_zenith
+                        + dd * dd * inv_depth;
+
+                    // Patch distance normalized by the variance. Subtracting
+                    // the variance cancels the expected contribution of the
+                    // noise itself.
+                    float patch_distance = 0.0f;
+                    for (int oy = -PATCH_RADIUS; oy <= PATCH_RADIUS; ++oy) {
+                        for (int ox = -PATCH_RADIUS; ox <= PATCH_RADIUS; ++ox) {
+                            size_t pp = index(x + ox, y + oy);
+                            size_t qq = index(qx + ox, qy + oy);
+                            float var_p = features.variance[pp];
+                            float var_q = features.variance[qq];
+                            float diff = color[pp] - color[qq];
+                            patch_distance +=
+                                (diff * diff - (var_p + std::min(var_p, var_q)))
+                                / (1e-10f + k2 * (var_p + var_q));
+                        }
+                    }
+                    patch_distance = std::max(0.0f, patch_distance * patch_norm);
+
+                    float w = std::exp(-patch_distance - feature_distance);
+                    sum += w * color[q];
+                    sum_weights += w;
+                }
+            }
+            output[p] = sum_weights > 0.0f ? sum / sum_weights : color[p];
+        }
+    });
+}
@@ -0,0 +1,60 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef DENOISER_HXX
+#define DENOISER_HXX
+
+#include <vector>
+
+/**
+ * Auxiliary per-pixel buffers that guide the denoiser. They are stored in
+ * scanline order with the same dimensions as the image.
+ */
+struct FeatureBuffers {
+    std::vector<float> variance;      // Variance of the pixel estimate
+    std::vector<float> view_zenith;   // Zenith angle of the view ray (radians)
+    std::vector<float> optical_depth; // Optical depth along the view ray
+};
+
+/**
+ * Non-local means filter with variance-normalized patch distances, as in
+ * Rousselle et al. (2012), cross-filtered with the view zenith angle and the
+ * optical depth so that edges like the horizon are preserved.
+ */
+class Denoiser final {
+public:
+    /**
+     * radius is the half-size of the search window in pixels. strength (k in
+     * the paper) controls how different two patches can be, relative to their
+     * noise, before they are rejected.
+     */
+    Denoiser(int radius, float strength);
+
+    void denoise(const std::vector<float> &color,
+                 const FeatureBuffers &features,
+                 int width, int height,
+                 std::vector<float> &output) const;
+private:
+    int _radius;
+    float _strength;
+};
+
+#endif // DENOISER_HXX
@@ -0,0 +1,427 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "exr.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+#include <zlib.h>
+#define TINYEXR_USE_MINIZ 0
+#define TINYEXR_USE_THREAD 1
+#define TINYEXR_IMPLEMENTATION
+#include "tinyexr.h"
+
+int
+parse_exr_compression(const std::string &name)
+{
+    if (name == "none")
+        return TINYEXR_COMPRESSIONTYPE_NONE;
+    if (name == "rle")
+        return TINYEXR_COMPRESSIONTYPE_RLE;
+    if (name == "zips")
+        return TINYEXR_COMPRESSIONTYPE_ZIPS;
+    if (name == "zip")
+        return TINYEXR_COMPRESSIONTYPE_ZIP;
+    if (name == "piz")
+        return TINYEXR_COMPRESSIONTYPE_PIZ;
+    throw std::runtime_error("Unknown or unsupported EXR compression '" + name
+                             + "'");
+}
+
+bool
+save_exr_channels(const std::string &filename, int width, int height,
+                  const std::vector<std::pair<std::string, const float *>> &channels,
+                  const ExrOptions &options, ExrStats *stats,
+                  const ExrAttributes *attributes)
+{
+    using namespace std::chrono;
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    EXRImage image;
+    InitEXRImage(&image);
+
+    std::vector<EXRChannelInfo> channel_infos(channels.size());
+    std::vector<int> pixel_types(channels.size(), TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<int> requested_pixel_types(
+        channels.size(),
+        options.half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<const float *> image_ptrs(channels.size());
+    for (size_t i = 0; i < channels.size(); ++i) {
+        strncpy(channel_infos[i].name, channels[i].first.c_str(), 255);
+        channel_infos[i].name[255] = '\0';
+        image_ptrs[i] = channels[i].second;
+    }
+
+    header.num_channels = channels.size();
+    header.channels = channel_infos.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = requested_pixel_types.data();
+    header.compression_type = options.compression;
+
+    std::vector<EXRAttribute> custom_attributes;
+    if (attributes) {
+        for (const auto &[name, value] : *attributes) {
+            EXRAttribute attribute = {};
+            strncpy(attribute.name, name.c_str(), 255);
+            strcpy(attribute.type, "string");
+            attribute.value = reinterpret_cast<unsigned char *>(
+                const_cast<char *>(value.data()));
+            attribute.size = value.size();
+            custom_attributes.push_back(attribute);
+        }
+    }
+    header.num_custom_attributes = custom_attributes.size();
+    header.custom_attributes = custom_attributes.data();
+
+    image.num_channels = channels.size();
+    image.images = reinterpret_cast<unsigned char **>(
+        const_cast<float **>(image_ptrs.data()));
+    image.width = width;
+    image.height = height;
+
+    // Encode to memory first, so the encoding and the I/O can be timed
+    // separately.
+    auto start = steady_clock::now();
+    unsigned char *memory = nullptr;
+    const char *err = nullptr;
+    size_t size = SaveEXRImageToMemory(&image, &header, &memory, &err);
+    if (size == 0) {
+        std::cerr << "Failed to write EXR image: " << (err ? err : "") << std::endl;
+        FreeEXRErrorMessage(err);
+        return false;
+    }
+    auto encoded = steady_clock::now();
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    bool written = file && fwrite(memory, 1, size, file) == size;
+    if (file && fclose(file) != 0)
+        written = false;
+    free(memory);
+    if (!written) {
+        std::cerr << "Failed to write EXR image: cannot write " << filename
+                  << std::endl;
+        return false;
+    }
+
+    if (stats) {
+        stats->bytes = size;
+        stats->encode_seconds = duration<double>(encoded - start).count();
+        stats->write_seconds =
+            duration<double>(steady_clock::now() - encoded).count();
+    }
+    return true;
+}
+
+bool
+load_exr_channels(const std::string &filename, int &width, int &height,
+                  const std::vector<std::string> &names,
+                  std::vector<std::vector<float>> &channels,
+                  ExrAttributes *attributes)
+{
+    EXRVersion version;
+    if (ParseEXRVersionFromFile(&version, filename.c_str()) != TINYEXR_SUCCESS)
+        return false;
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    const char *err = nullptr;
+    if (ParseEXRHeaderFromFile(&header, &version, filename.c_str(), &err)
+        != TINYEXR_SUCCESS) {
+        FreeEXRErrorMessage(err);
+        return false;
+    }
+    for (int i = 0; i < header.num_channels; ++i)
+        header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+    for (int i = 0; attributes && i < header.num_custom_attributes; ++i) {
+        const EXRAttribute &attribute = header.custom_attributes[i];
+        if (strcmp(attribute.type, "string") == 0)
+            (*attributes)[attribute.name] = std::string(
+                reinterpret_cast<const char *>(attribute.value), attribute.size);
+    }
+
+    EXRImage image;
+    InitEXRImage(&image);
+    if (LoadEXRImageFromFile(&image, &header, filename.c_str(), &err)
+        != TINYEXR_SUCCESS) {
+        FreeEXRErrorMessage(err);
+        FreeEXRHeader(&header);
+        return false;
+    }
+
+    bool found = image.images != nullptr;
+    width = image.width;
+    height = image.height;
+    channels.assign(names.size(), {});
+    for (size_t n = 0; found && n < names.size(); ++n) {
+        found = false;
+        for (int i = 0; i < header.num_channels; ++i) {
+            if (names[n] != header.channels[i].name)
+                continue;
+            const float *data = reinterpret_cast<const float *>(image.images[i]);
+            channels[n].assign(data, data + size_t(width) * height);
+            found = true;
+            break;
+        }
+    }
+
+    FreeEXRImage(&image);
+    FreeEXRHeader(&header);
+    return found;
+}
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Little-endian serialization, as required by the EXR format
+void
+put_u32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out += char((value >> (8 * i)) & 0xff);
+}
+
+void
+put_u64(std::string &out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out += char((value >> (8 * i)) & 0xff);
+}
+
+void
+put_f32(std::string &out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u32(out, bits);
+}
+
+void
+put_half(std::string &out, float value)
+{
+    tinyexr::FP32 f;
+    f.f = value;
+    uint16_t bits = tinyexr::float_to_half_full(f).u;
+    out += char(bits & 0xff);
+    out += char(bits >> 8);
+}
+
+void
+put_attribute(std::string &out, const char *name, const char *type,
+              const std::string &value)
+{
+    out += name;
+    out += '\0';
+    out += type;
+    out += '\0';
+    put_u32(out, value.size());
+    out += value;
+}
+
+/**
+ * Compress a block of pixel data the way EXR ZIP compression does: split the
+ * even and odd bytes, delta-encode them and deflate the result. Blocks that
+ * do not shrink are stored uncompressed.
+ */
+std::string
+zip_compress(const std::string &raw)
+{
+    std::string shuffled(raw.size(), '\0');
+    size_t half = (raw.size() + 1) / 2;
+    for (size_t i = 0; i < raw.size(); ++i)
+        shuffled[(i % 2 ? half : 0) + i / 2] = raw[i];
+    for (size_t i = shuffled.size() - 1; i > 0; --i) {
+        int d = int((unsigned char)shuffled[i])
+            - int((unsigned char)shuffled[i - 1]) + 128;
+        shuffled[i] = char(d & 0xff);
+    }
+
+    uLongf size = compressBound(shuffled.size());
+    std::string compressed(size, '\0');
+    if (compress(reinterpret_cast<Bytef *>(&compressed[0]), &size,
+                 reinterpret_cast<const Bytef *>(shuffled.data()),
+                 shuffled.size()) != Z_OK || size >= raw.size())
+        return raw;
+    compressed.resize(size);
+    return compressed;
+}
+
+} // anonymous namespace
+
+TiledExrWriter::TiledExrWriter(const std::string &filename, int x0, int y0,
+                               int width, int height, int display_width,
+                               int display_height, int tile_width,
+                               int tile_height,
+                               const std::vector<std::string> &channels,
+                               const ExrOptions &options) :
+    _width(width), _height(height),
+    _tile_width(tile_width), _tile_height(tile_height),
+    _x_tiles((width + tile_width - 1) / tile_width),
+    _y_tiles((height + tile_height - 1) / tile_height),
+    _half(options.half),
+    _compress(options.compression != TINYEXR_COMPRESSIONTYPE_NONE)
+{
+    // A tile is a single block, so zips and zip are the same
+    if (options.compression != TINYEXR_COMPRESSIONTYPE_NONE
+        && options.compression != TINYEXR_COMPRESSIONTYPE_ZIPS
+        && options.compression != TINYEXR_COMPRESSIONTYPE_ZIP)
+        throw std::runtime_error("Tiled EXR images only support the none, zips "
+                                 "and zip compressions");
+
+    _channel_order.resize(channels.size());
+    std::iota(_channel_order.begin(), _channel_order.end(), 0);
+    std::sort(_channel_order.begin(), _channel_order.end(),
+              [&](size_t a, size_t b) { return channels[a] < channels[b]; });
+
+    _file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!_file)
+        throw std::runtime_error("Could not open " + filename);
+
+    std::string header;
+    // Magic number and version 2 with the tiled flag
+    put_u32(header, 20000630);
+    put_u32(header, 2 | 0x200);
+
+    std::string chlist;
+    for (size_t c : _channel_order) {
+        chlist += channels[c];
+        chlist += '\0';
+        put_u32(chlist, _half ? 1 : 2); // HALF or FLOAT
+        chlist += std::string(4, '\0'); // pLinear and reserved
+        put_u32(chlist, 1);            // x sampling
+        put_u32(chlist, 1);            // y sampling
+    }
+    chlist += '\0';
+    put_attribute(header, "channels", "chlist", chlist);
+    put_attribute(header, "compression", "compression",
+                  std::string(1, char(options.compression)));
+    std::string data_window;
+    put_u32(data_window, x0);
+    put_u32(data_window, y0);
+    put_u32(data_window, x0 + width - 1);
+    put_u32(data_window, y0 + height - 1);
+    put_attribute(header, "dataWindow", "box2i", data_window);
+    std::string display_window;
+    put_u32(display_window, 0);
+    put_u32(display_window, 0);
+    put_u32(display_window, display_width - 1);
+    put_u32(display_window, display_height - 1);
+    put_attribute(header, "displayWindow", "box2i", display_window);
+    // Tiles are stored in the order they are finished, which readers find
+    // through the offset table. RANDOM_Y would be more accurate, but tinyexr
+    // flips the lines of the tiles for any order other than INCREASING_Y.
+    put_attribute(header, "lineOrder", "lineOrder", std::string(1, 0));
+    std::string aspect;
+    put_f32(aspect, 1.0f);
+    put_attribute(header, "pixelAspectRatio", "float", aspect);
+    std::string center;
+    put_f32(center, 0.0f);
+    put_f32(center, 0.0f);
+    put_attribute(header, "screenWindowCenter", "v2f", center);
+    std::string screen_width;
+    put_f32(screen_width, 1.0f);
+    put_attribute(header, "screenWindowWidth", "float", screen_width);
+    std::string tiles;
+    put_u32(tiles, tile_width);
+    put_u32(tiles, tile_height);
+    tiles += '\0'; // ONE_LEVEL, ROUND_DOWN
+    put_attribute(header, "tiles", "tiledesc", tiles);
+    header += '\0';
+
+    // Reserve the offset table, which is written once all tiles are done
+    _table_offset = header.size();
+    _tile_offsets.assign(size_t(_x_tiles) * _y_tiles, 0);
+    header += std::string(_tile_offsets.size() * sizeof(uint64_t), '\0');
+    _file.write(header.data(), header.size());
+}
+
+TiledExrWriter::~TiledExrWriter()
+{
+    if (_file.is_open())
+        finish();
+}
+
+void
+TiledExrWriter::write_tile(int tile_x, int tile_y,
+                           const std::vector<const float *> &channels)
+{
+    int width = std::min(_tile_width, _width - tile_x * _tile_width);
+    int height = std::min(_tile_height, _height - tile_y * _tile_height);
+
+    // Every line of the tile holds the channels one after the other
+    std::string raw;
+    raw.reserve(size_t(width) * height * channels.size() * sizeof(float));
+    for (int y = 0; y < height; ++y) {
+        for (size_t c : _channel_order) {
+            for (int x = 0; x < width; ++x) {
+                float value = channels[c][size_t(y) * width + x];
+                if (_half)
+                    put_half(raw, value);
+                else
+                    put_f32(raw, value);
+            }
+        }
+    }
+
+    std::string chunk;
+    put_u32(chunk, tile_x);
+    put_u32(chunk, tile_y);
+    put_u32(chunk, 0); // level
+    put_u32(chunk, 0);
+    std::string data = _compress ? zip_compress(raw) : raw;
+    put_u32(chunk, data.size());
+    chunk += data;
+
+    std::scoped_lock lock(_mutex);
+    _tile_offsets[size_t(tile_y) * _x_tiles + tile_x] = _file.tellp();
+    _file.write(chunk.data(), chunk.size());
+}
+
+void
+TiledExrWriter::finish()
+{
+    std::scoped_lock lock(_mutex);
+    if (std::count(_tile_offsets.begin(), _tile_offsets.end(), 0))
+        std::cerr << "Warning: some tiles of the EXR image were not written\n";
+    std::string table;
+    for (uint64_t offset : _tile_offsets)
+        put_u64(table, offset);
+    _bytes_written = _file.tellp();
+    _file.seekp(_table_offset);
+    _file.write(table.data(), table.size());
+    _file.close();
+    if (!_file)
+        std::cerr << "Failed to write the tiled EXR image\n";
+}
+
+uint64_t
+TiledExrWriter::bytes_written()
+{
+    std::scoped_lock lock(_mutex);
+    return _file.is_open() ? uint64_t(_file.tellp()) : _bytes_written;
+}
@@ -0,0 +1,129 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef EXR_HXX
+#define EXR_HXX
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Encoding of EXR files. Half floats halve the size of the files at the cost
+ * of 11 bits of precision.
+ */
+struct ExrOptions {
+    bool half = false;
+    // One of the TINYEXR_COMPRESSIONTYPE_* constants
+    int compression = 3;
+};
+
+// Size and timings of a saved EXR file
+struct ExrStats {
+    size_t bytes = 0;
+    double encode_seconds = 0.0;
+    double write_seconds = 0.0;
+};
+
+// String attributes stored in the header of an EXR file, by name
+using ExrAttributes = std::map<std::string, std::string>;
+
+/**
+ * Map a compression name (none, rle, zips, zip or piz) to its
+ * TINYEXR_COMPRESSIONTYPE_* constant. Throws std::runtime_error for unknown
+ * or unsupported names.
+ */
+int parse_exr_compression(const std::string &name);
+
+/**
+ * Save a set of single channel images as the channels of a single EXR file.
+ * The channels should be given in alphabetical order, which is how most
+ * readers expect them. The blocks of the file are compressed in parallel.
+ * Returns false and prints the error on failure.
+ */
+bool save_exr_channels(const std::string &filename, int width, int height,
+                       const std::vector<std::pair<std::string, const float *>> &channels,
+                       const ExrOptions &options = ExrOptions(),
+                       ExrStats *stats = nullptr,
+                       const ExrAttributes *attributes = nullptr);
+
+/**
+ * Load the named channels of an EXR file as floats, and its string attributes
+ * if attributes is not null. Returns false if the file cannot be read or
+ * lacks any of the channels.
+ */
+bool load_exr_channels(const std::string &filename, int &width, int &height,
+                       const std::vector<std::string> &names,
+                       std::vector<std::vector<float>> &channels,
+                       ExrAttributes *attributes = nullptr);
+
+/**
+ * Writes a tiled EXR file one tile at a time, so that images
+ * larger than memory can be saved while they are rendered. The tiles can be
+ * written in any order and from several threads; each one is compressed by
+ * the calling thread. The tile offset table is filled in by finish().
+ *
+ * The data window (x0, y0, width, height) may be a part of the display window
+ * (display_width, display_height), e.g. when rendering a crop window. Tiles
+ * are counted from the data window origin, and the tiles on the right and
+ * bottom edges may be smaller than tile_width x tile_height. Only the none,
+ * zips and zip compressions are supported.
+ */
+class TiledExrWriter final {
+public:
+    TiledExrWriter(const std::string &filename, int x0, int y0, int width,
+                   int height, int display_width, int display_height,
+                   int tile_width, int tile_height,
+                   const std::vector<std::string> &channels,
+                   const ExrOptions &options = ExrOptions());
+    ~TiledExrWriter();
+
+    /**
+     * Write the tile (tile_x, tile_y). channels holds one plane per channel,
+     * in the order given to the constructor, each with the pixels of the tile
+     * row by row.
+     */
+    void write_tile(int tile_x, int tile_y,
+                    const std::vector<const float *> &channels);
+    // Write the offset table and close the file
+    void finish();
+    uint64_t bytes_written();
+private:
+    int _width, _height;
+    int _tile_width, _tile_height;
+    int _x_tiles, _y_tiles;
+    bool _half;
+    bool _compress;
+    // Position of the channels in the file, which are sorted by name
+    std::vector<size_t> _channel_order;
+
+    std::mutex _mutex;
+    std::ofstream _file;
+    uint64_t _table_offset;
+    uint64_t _bytes_written = 0;
+    std::vector<uint64_t> _tile_offsets;
+};
+
+#endif // EXR_HXX
@@ -0,0 +1,181 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "frames.hxx"
+
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static_assert(sizeof(SharedFrameHeader) <= SharedMemoryFramePublisher::PIXELS_OFFSET,
+              "The shared frame header does not fit before the pixels");
+
+namespace {
+
+/**
+ * Blocks SIGPIPE in the calling thread while it is alive, so that a reader
+ * closing the pipe makes write() fail with EPIPE instead of killing the
+ * process. The rest of the process keeps its own SIGPIPE handling.
+ */
+class SigpipeBlocker final {
+public:
+    SigpipeBlocker() {
+        sigemptyset(&_sigpipe);
+        sigaddset(&_sigpipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &_sigpipe, &_old_mask);
+        sigset_t pending;
+        sigpending(&pending);
+        _was_pending = sigismember(&pending, SIGPIPE);
+    }
+    ~SigpipeBlocker() {
+        pthread_sigmask(SIG_SETMASK, &_old_mask, nullptr);
+    }
+
+    // Discard the SIGPIPE raised by a write that failed with EPIPE
+    void discard() {
+        if (_was_pending)
+            return;
+        struct timespec zero = {0, 0};
+        while (sigtimedwait(&_sigpipe, nullptr, &zero) < 0 && errno == EINTR)
+            ;
+    }
+private:
+    sigset_t _sigpipe;
+    sigset_t _old_mask;
+    bool _was_pending;
+};
+
+} // anonymous namespace
+
+PipeFramePublisher::PipeFramePublisher(const std::string &path, int width,
+                                       int height) :
+    _frame_size(size_t(width) * height * sizeof(float))
+{
+    if (path == "-") {
+        _fd = STDOUT_FILENO;
+    } else {
+        _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0)
+            throw std::runtime_error("Could not open " + path + ": "
+                                     + strerror(errno));
+    }
+}
+
+PipeFramePublisher::~PipeFramePublisher()
+{
+    if (_fd > STDERR_FILENO)
+        close(_fd);
+}
+
+void
+PipeFramePublisher::publish(const float *pixels, float)
+{
+    if (_fd < 0)
+        return;
+    SigpipeBlocker blocker;
+    const char *data = reinterpret_cast<const char *>(pixels);
+    size_t written = 0;
+    while (written < _frame_size) {
+        ssize_t count = write(_fd, data + written, _frame_size - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0) {
+            if (count < 0 && errno == EPIPE) {
+                blocker.discard();
+                std::cerr << "\nStopped publishing frames: the reader closed "
+                          << "the pipe\n";
+            } else {
+                std::cerr << "\nStopped publishing frames: "
+                          << strerror(errno) << "\n";
+            }
+            if (_fd > STDERR_FILENO)
+                close(_fd);
+            _fd = -1;
+            return;
+        }
+        written += count;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+SharedMemoryFramePublisher::SharedMemoryFramePublisher(const std::string &name,
+                                                       int width, int height) :
+    _size(PIXELS_OFFSET + size_t(width) * height * sizeof(float))
+{
+    std::string shm_name = name[0] == '/' ? name : "/" + name;
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not open the shared memory segment "
+                                 + shm_name + ": " + strerror(errno));
+    if (ftruncate(fd, _size) < 0) {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Could not resize the shared memory segment "
+                                 + shm_name + ": " + error);
+    }
+    _memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (_memory == MAP_FAILED)
+        throw std::runtime_error("Could not map the shared memory segment "
+                                 + shm_name + ": " + strerror(errno));
+
+    _header = new (_memory) SharedFrameHeader;
+    _pixels = reinterpret_cast<float *>(static_cast<char *>(_memory)
+                                        + PIXELS_OFFSET);
+    uint64_t sequence = _header->sequence.load() + 1;
+    _header->sequence.store(sequence | 1);
+    memcpy(_header->magic, "SKYFRAME", 8);
+    _header->version = 1;
+    _header->width = width;
+    _header->height = height;
+    _header->reserved = 0;
+    _header->frame = 0;
+    _header->progress = 0.0f;
+    memset(_pixels, 0, _size - PIXELS_OFFSET);
+    _header->sequence.store((sequence | 1) + 1, std::memory_order_release);
+}
+
+SharedMemoryFramePublisher::~SharedMemoryFramePublisher()
+{
+    munmap(_memory, _size);
+}
+
+void
+SharedMemoryFramePublisher::publish(const float *pixels, float progress)
+{
+    uint64_t sequence = _header->sequence.load(std::memory_order_relaxed);
+    _header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(_pixels, pixels, _size - PIXELS_OFFSET);
+    _header->frame.fetch_add(1, std::memory_order_relaxed);
+    _header->progress.store(progress, std::memory_order_relaxed);
+    _header->sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,94 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef FRAMES_HXX
+#define FRAMES_HXX
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Publishes the framebuffer while it is being rendered, for live monitoring
+ * or for consumers that process images as they are produced. Frames are
+ * width x height floats stored row by row.
+ */
+class FramePublisher {
+public:
+    virtual ~FramePublisher() = default;
+    // progress is the fraction of the image that is done, 1 for the last frame
+    virtual void publish(const float *pixels, float progress) = 0;
+};
+
+/**
+ * Writes raw float32 frames, without any header, to a file, a named pipe or
+ * stdout ("-"). They can be read e.g. by ffmpeg with -f rawvideo
+ * -pix_fmt grayf32le. Opening a named pipe blocks until it has a reader.
+ */
+class PipeFramePublisher final : public FramePublisher {
+public:
+    PipeFramePublisher(const std::string &path, int width, int height);
+    virtual ~PipeFramePublisher();
+    virtual void publish(const float *pixels, float progress);
+private:
+    int _fd;
+    size_t _frame_size;
+};
+
+/**
+ * Header of the POSIX shared memory segment written by
+ * SharedMemoryFramePublisher. The pixels follow the header.
+ *
+ * The sequence counter works as a seqlock: it is odd while a frame is being
+ * written. Readers copy the frame between two reads of an even counter and
+ * retry if it changed, so they never block the renderer.
+ */
+struct SharedFrameHeader {
+    char magic[8];        // "SKYFRAME"
+    uint32_t version;     // 1
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> frame;
+    std::atomic<float> progress;
+};
+
+class SharedMemoryFramePublisher final : public FramePublisher {
+public:
+    /**
+     * name is the name of the segment given to shm_open(), e.g. "/sky". The
+     * segment is left in place afterwards so the last frame can be read.
+     */
+    SharedMemoryFramePublisher(const std::string &name, int width, int height);
+    virtual ~SharedMemoryFramePublisher();
+    virtual void publish(const float *pixels, float progress);
+
+    // Offset of the pixels from the start of the segment
+    static const size_t PIXELS_OFFSET = 64;
+private:
+    void *_memory;
+    size_t _size;
+    SharedFrameHeader *_header;
+    float *_pixels;
+};
+
+#endif // FRAMES_HXX
@@ -21,21 +21,16 @@
 
 #include "integrator.hxx"
 
+#include <algorithm>
 #include <iostream>
 
+#include "pathlog.hxx"
 #include "sampler.hxx"
 #include "scene.hxx"
+#include "stats.hxx"
 
 using namespace glm;
 
-namespace {
-
-/**
- * Return the distance between the ray origin and the first intersection with
- * a sphere centered in (0, 0, 0), or -1 if there is no intersection.
- * -1 is also returned if the ray is pointing away from the sphere (even if
- * there is an intersection).
- */
 float
 ray_sphere_intersection(const Ray &ray, float sr)
 {
@@ -49,39 +44,10 @@ ray_sphere_intersection(const Ray &ray, float sr)
     return (-b-sqrtf(d));
 }
 
-/**
- * Return an uniformly distributed vector on the unit sphere given two uniform
- * random variables.
- */
-vec3
-sample_uniform_sphere(const vec2 &s)
-{
-    float phi = M_TWO_PI * s.x;
-    float cos_theta = s.y * 2.0f - 1.0f;
-    float sin_theta = sqrtf(1.0f - cos_theta*cos_theta);
-    return vec3(cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta);
-}
-
-/**
- * Return a cosine weighted vector on the unit hemisphere given two uniform
- * random variables.
- */
-vec3
-sample_cosine_weighted_hemisphere(const vec2 &sample)
-{
-    float phi = M_TWO_PI * sample.x;
-    float cos_theta = sqrtf(sample.y);
-    float sin_theta = sqrtf(1.0f - cos_theta*cos_theta);
-    return vec3(cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta);
-}
-
-/**
- * Determine the next interaction point (scattering or absorption event) along
- * a ray inside the atmospheric medium using delta tracking.
- */
 float
 sample_interaction(const Atmosphere *atmosphere, Sampler *sampler,
-                   const Ray &ray, float t_max, float wl, vec3 &p)
+                   const Ray &ray, float t_max, float wl, vec3 &p,
+                   RenderCounters &counters)
 {
     float majorant = atmosphere->get_max_extinction(wl);
     float t = 0.0f;
@@ -93,17 +59,14 @@ sample_interaction(const Atmosphere *atmosphere, Sampler *sampler,
         float extinction = atmosphere->get_extinction(p, wl);
         if (sampler->next_1d() < fmaxf(0.0f, extinction / majorant))
             return t;
+        ++counters.null_collisions;
     } while(true);
     return -1.0f;
 }
 
-/**
- * Compute the transmittance along a ray segment with ratio tracking from
- * Nóvak et al. (2014).
- */
 float
 transmittance(const Atmosphere *atmosphere, Sampler *sampler,
-              const Ray &ray, float t_max, float wl)
+              const Ray &ray, float t_max, float wl, RenderCounters &counters)
 {
     float majorant = atmosphere->get_max_extinction(wl);
     float Tr = 1.0f;
@@ -115,10 +78,41 @@ transmittance(const Atmosphere *atmosphere, Sampler *sampler,
         vec3 p = ray.o + ray.d * t;
         float extinction = atmosphere->get_extinction(p, wl);
         Tr *= 1.0f - fmaxf(0.0f, extinction / majorant);
+        ++counters.null_collisions;
     } while(true);
     return Tr;
 }
 
+//------------------------------------------------------------------------------
+
+namespace {
+
+/**
+ * Return an uniformly distributed vector on the unit sphere given two uniform
+ * random variables.
+ */
+vec3
+sample_uniform_sphere(const vec2 &s)
+{
+    float phi = M_TWO_PI * s.x;
+    float cos_theta = s.y * 2.0f - 1.0f;
+    float sin_theta = sqrtf(1.0f - cos_theta*cos_theta);
+    return vec3(cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta);
+}
+
+/**
+ * Return a cosine weighted vector on the unit hemisphere given two uniform
+ * random variables.
+ */
+vec3
+sample_cosine_weighted_hemisphere(const vec2 &sample)
+{
+    float phi = M_TWO_PI * sample.x;
+    float cos_theta = sqrtf(sample.y);
+    float sin_theta = sqrtf(1.0f - cos_theta*cos_theta);
+    return vec3(cosf(phi) * sin_theta, sinf(phi) * sin_theta, cos_theta);
+}
+
 float
 sample_background(const Ray &ray, float wl)
 {
@@ -170,15 +164,17 @@ scene_intersect(const Ray &ray, bool &intersected_earth)
 void
 sample_sun(const Scene *scene, Sampler *sampler, const vec3 &p,
            float wl, vec3 &shadow_ray_dir, float &beam_transmittance,
-           float &L)
+           float &L, RenderCounters &counters)
 {
+    ++counters.shadow_rays;
     L = scene->light->sample(sampler->next_2d(), shadow_ray_dir, wl);
     Ray shadow_ray(p, shadow_ray_dir);
     float earth_t = ray_sphere_intersection(shadow_ray, EARTH_RADIUS);
     if (earth_t < 0.0f) {
         float t = ray_sphere_intersection(shadow_ray, ATMOSPHERE_RADIUS);
         beam_transmittance = transmittance(scene->atmosphere.get(),
-                                           sampler, shadow_ray, t, wl);
+                                           sampler, shadow_ray, t, wl,
+                                           counters);
     } else {
         beam_transmittance = 0.0f;
     }
@@ -188,16 +184,44 @@ sample_sun(const Scene *scene, Sampler *sampler, const vec3 &p,
 
 //------------------------------------------------------------------------------
 
+float
+optical_depth(const Scene *scene, const Ray &ray, float wl)
+{
+    bool intersected_earth;
+    float t_max = scene_intersect(ray, intersected_earth);
+    if (t_max < 0.0f)
+        return 0.0f;
+    // Quadratic spacing to place more steps close to the origin, where the
+    // density is usually higher.
+    const int num_steps = 128;
+    float tau = 0.0f;
+    float prev_t = 0.0f;
+    for (int i = 1; i <= num_steps; ++i) {
+        float s = float(i) / num_steps;
+        float t = t_max * s * s;
+        float mid_t = 0.5f * (prev_t + t);
+        tau += scene->atmosphere->get_extinction(ray.o + ray.d * mid_t, wl)
+            * (t - prev_t);
+        prev_t = t;
+    }
+    return tau;
+}
+
+//------------------------------------------------------------------------------
+
 float
 TransmittanceIntegrator::Li(const Scene *scene, Sampler *sampler,
                             const Ray &ray, float wl)
 {
+    RenderCounters &counters = thread_counters();
+    ++counters.camera_rays;
     bool intersected_earth;
     float t_max = scene_intersect(ray, intersected_earth);
     if (t_max < 0.0f) {
         return 0.0f;
     }
-    return transmittance(scene->atmosphere.get(), sampler, ray, t_max, wl);
+    return transmittance(scene->atmosphere.get(), sampler, ray, t_max, wl,
+                         counters);
 }
 
 //------------------------------------------------------------------------------
@@ -215,10 +239,22 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
     const Atmosphere *atmosphere = scene->atmosphere.get();
     const LightSource *light = scene->light.get();
 
+    RenderCounters &counters = thread_counters();
+    ++counters.camera_rays;
+    uint64_t path_length = 0;
+
     Ray ray = ray_;
     float L = 0.0f;
     float throughput = 1.0f;
 
+    RecordedPath *record = path_recording_enabled.load(std::memory_order_relaxed)
+        ? recorded_path() : nullptr;
+    if (record) {
+        record->add_vertex(PathVertexType::CAMERA, ray.o, throughput);
+        // Changed below if the path ends before the maximum order
+        record->set_end(PathEnd::MAX_ORDER);
+    }
+
     for (int order = 1; order <= _max_order; ++order) {
         bool intersected_earth;
         float t_max = scene_intersect(ray, intersected_earth);
@@ -226,18 +262,25 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
             // No intersection with the atmosphere or the Earth. Add the
             // background and terminate the ray.
             L += sample_background(ray, wl);
+            if (record)
+                record->set_end(PathEnd::ESCAPED);
             break;
         }
 
         vec3 interaction_point;
         float t = sample_interaction(atmosphere, sampler, ray, t_max,
-                                     wl, interaction_point);
+                                     wl, interaction_point, counters);
         if (t < 0.0f) {
             // We didn't find an interaction point inside the given ray segment
             if (!intersected_earth) {
                 // Ray exited the atmosphere, add contribution from the
                 // background and terminate the path.
                 L += sample_background(ray, wl);
+                if (record) {
+                    record->add_vertex(PathVertexType::EXIT,
+                                       ray.o + ray.d * t_max, throughput);
+                    record->set_end(PathEnd::ESCAPED);
+                }
                 break;
             } else {
                 // Surface interaction
@@ -250,9 +293,18 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
                 // prefer to leave it black and only add the multiple scattering
                 // contribution that affects the sky's color.
 
+                ++counters.ground_bounces;
+                ++counters.scattering_orders[
+                    std::min(order, RenderCounters::ORDER_BINS) - 1];
+                ++path_length;
+
                 float bsdf = scene->ground_albedo * M_INV_PI;
 
                 vec3 shading_point = ray.o + ray.d * t_max;
+                if (record) {
+                    record->add_vertex(PathVertexType::GROUND, shading_point,
+                                       throughput);
+                }
                 vec3 n = normalize(shading_point - EARTH_CENTER);
                 // To avoid self-intersection due to floating point precision
                 shading_point += n;
@@ -260,10 +312,15 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
                 vec3 shadow_ray_dir;
                 float beam_transmittance, sun_L;
                 sample_sun(scene, sampler, shading_point, wl,
-                           shadow_ray_dir, beam_transmittance, sun_L);
+                           shadow_ray_dir, beam_transmittance, sun_L,
+                           counters);
                 float ndotl = dot(n, shadow_ray_dir);
                 if (!_only_ms || order > 1) {
-                    L += throughput * sun_L * bsdf * beam_transmittance * ndotl;
+                    float contribution =
+                        throughput * sun_L * bsdf * beam_transmittance * ndotl;
+                    L += contribution;
+                    if (record)
+                        record->add_contribution(contribution);
                 }
 
                 // Accumulate the weight
@@ -291,23 +348,36 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
             // Medium interaction
             //------------------------------------------------------------------
 
+            ++counters.real_collisions;
+            ++path_length;
+
             float scattering_albedo = atmosphere->get_scattering_albedo(
                 interaction_point, wl);
 
             // Russian roulette to determine the collision event type
             if (sampler->next_1d() < scattering_albedo) {
                 // Scattering event
+                ++counters.scattering_orders[
+                    std::min(order, RenderCounters::ORDER_BINS) - 1];
+                if (record) {
+                    record->add_vertex(PathVertexType::SCATTERING,
+                                       interaction_point, throughput);
+                }
 
                 // Perform Next-Event Estimation by tracing a shadow ray to the Sun
                 vec3 shadow_ray_dir;
                 float beam_transmittance, sun_L;
                 sample_sun(scene, sampler, interaction_point, wl,
-                           shadow_ray_dir, beam_transmittance, sun_L);
+                           shadow_ray_dir, beam_transmittance, sun_L,
+                           counters);
                 float phase = atmosphere->phase_eval(
                     interaction_point, sampler->next_1d(), -ray.d, shadow_ray_dir, wl);
                 if (!_only_ms || order > 1) {
-                    L += throughput * sun_L * phase * beam_transmittance
-                        * scattering_albedo;
+                    float contribution = throughput * sun_L * phase
+                        * beam_transmittance * scattering_albedo;
+                    L += contribution;
+                    if (record)
+                        record->add_contribution(contribution);
                 }
 
                 vec3 wi = sample_uniform_sphere(sampler->next_2d());
@@ -321,6 +391,11 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
                 ray = Ray(interaction_point, wi);
             } else {
                 // Absorption event, so terminate the path
+                if (record) {
+                    record->add_vertex(PathVertexType::ABSORPTION,
+                                       interaction_point, throughput);
+                    record->set_end(PathEnd::ABSORBED);
+                }
                 break;
             }
         }
@@ -329,16 +404,23 @@ PathTracingIntegrator::Li(const Scene *scene, Sampler *sampler,
         // low enough.
         if (order > 5) {
             float q = fmaxf(0.05f, 1.0f - throughput);
-            if (sampler->next_1d() < q)
+            if (sampler->next_1d() < q) {
+                if (record)
+                    record->set_end(PathEnd::TERMINATED);
                 break;
+            }
             throughput /= 1.0f - q;
         }
 
         // End the path if we lost all energy (should never be reached anyway)
         if (throughput <= 0.0f) {
+            if (record)
+                record->set_end(PathEnd::TERMINATED);
             break;
         }
     }
 
+    counters.path_vertices += path_length;
+    counters.max_path_length = std::max(counters.max_path_length, path_length);
     return L;
 }
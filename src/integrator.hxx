@@ -24,8 +24,10 @@
 
 #include "common.hxx"
 
+class Atmosphere;
 class Sampler;
 class Scene;
+struct RenderCounters;
 
 class Integrator {
 public:
@@ -49,4 +51,35 @@ private:
     bool _only_ms;
 };
 
+/**
+ * Return the distance between the ray origin and the first intersection with
+ * a sphere centered in (0, 0, 0), or -1 if there is no intersection.
+ * -1 is also returned if the ray is pointing away from the sphere (even if
+ * there is an intersection).
+ */
+float ray_sphere_intersection(const Ray &ray, float sr);
+
+/**
+ * Determine the next interaction point (scattering or absorption event) along
+ * a ray inside the atmospheric medium using delta tracking.
+ */
+float sample_interaction(const Atmosphere *atmosphere, Sampler *sampler,
+                         const Ray &ray, float t_max, float wl, glm::vec3 &p,
+                         RenderCounters &counters);
+
+/**
+ * Compute the transmittance along a ray segment with ratio tracking from
+ * Nóvak et al. (2014).
+ */
+float transmittance(const Atmosphere *atmosphere, Sampler *sampler,
+                    const Ray &ray, float t_max, float wl,
+                    RenderCounters &counters);
+
+/**
+ * Compute the optical depth along a ray until it hits the ground or leaves the
+ * atmosphere. This uses a deterministic quadrature instead of Monte Carlo, so
+ * it is noise-free but only approximate.
+ */
+float optical_depth(const Scene *scene, const Ray &ray, float wl);
+
 #endif // INTEGRATOR_HXX
@@ -0,0 +1,241 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "jobs.hxx"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "args.hxx"
+#include "cache.hxx"
+#include "json.hxx"
+#include "progress.hxx"
+#include "renderer.hxx"
+
+std::unique_ptr<CommandLineArguments>
+parse_job(const JsonValue &job, const CommandLineArguments &common)
+{
+    if (!job.is_object())
+        throw std::runtime_error("Every job must be a JSON object");
+
+    // Convert the job to command-line arguments on top of the common ones
+    std::vector<std::string> job_args = {"skytracer"};
+    job_args.insert(job_args.end(), common.base_args.begin(),
+                    common.base_args.end());
+    std::string output;
+    for (const auto &[key, value] : job.members()) {
+        if (key == "output") {
+            output = value.as_string();
+        } else if (value.type() == JsonValue::Type::Bool) {
+            if (value.as_bool())
+                job_args.push_back("--" + key);
+        } else if (value.is_array()) {
+            for (const JsonValue &item : value.items()) {
+                job_args.push_back("--" + key);
+                job_args.push_back(item.as_string());
+            }
+        } else {
+            job_args.push_back("--" + key);
+            job_args.push_back(value.as_string());
+        }
+    }
+    if (output.empty())
+        throw std::runtime_error("Job has no output");
+    job_args.push_back(output);
+
+    std::vector<char *> argv;
+    for (std::string &arg : job_args)
+        argv.push_back(arg.data());
+    auto args = std::make_unique<CommandLineArguments>();
+    args->parse_args(argv.size(), argv.data());
+    if (args->help || args->list_types)
+        throw std::runtime_error("Jobs cannot contain help or list options");
+    if (!args->views.empty() || !args->jobs_filename.empty()
+        || !args->socket_path.empty() || !args->dataset_filename.empty())
+        throw std::runtime_error("Jobs cannot contain views, other jobs, "
+                                 "servers or datasets");
+    return args;
+}
+
+AtmosphereCache::AtmosphereCache(size_t max_size) :
+    _max_size(max_size)
+{
+}
+
+std::shared_ptr<Atmosphere>
+AtmosphereCache::get(const CommandLineArguments &args)
+{
+    // The atmosphere only depends on these parameters. The turbidity is
+    // compared bit for bit, as close values give different atmospheres.
+    uint32_t turbidity_bits;
+    std::memcpy(&turbidity_bits, &args.turbidity, sizeof(turbidity_bits));
+    Key key(args.atmospheric_model, args.month, turbidity_bits,
+            args.aerosol_type);
+    std::scoped_lock lock(_mutex);
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->second;
+    }
+
+    std::shared_ptr<Atmosphere> atmosphere;
+    switch (args.atmospheric_model) {
+    case 0:
+        atmosphere = std::make_shared<GuimeraAtmosphere>(
+            args.month, args.turbidity, args.aerosol_type);
+        break;
+    default:
+        throw std::runtime_error("Unknown atmospheric model");
+    }
+    _entries.emplace_front(key, atmosphere);
+    _index[key] = _entries.begin();
+    if (_entries.size() > _max_size) {
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+    return atmosphere;
+}
+
+//------------------------------------------------------------------------------
+
+AsyncWriter::AsyncWriter(size_t max_pending) :
+    _max_pending(max_pending),
+    _thread(&AsyncWriter::loop, this)
+{
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    finish();
+}
+
+void
+AsyncWriter::push(std::unique_ptr<CommandLineArguments> args,
+                  std::unique_ptr<Renderer> renderer)
+{
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [this] { return _queue.size() < _max_pending; });
+    _queue.push_back({std::move(args), std::move(renderer)});
+    _cv.notify_all();
+}
+
+void
+AsyncWriter::finish()
+{
+    {
+        std::scoped_lock lock(_mutex);
+        _done = true;
+        _cv.notify_all();
+    }
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void
+AsyncWriter::loop()
+{
+    while (true) {
+        Output output;
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [this] { return !_queue.empty() || _done; });
+            if (_queue.empty())
+                return;
+            output = std::move(_queue.front());
+            _queue.pop_front();
+            _cv.notify_all();
+        }
+        const CommandLineArguments &args = *output.args;
+        Renderer &renderer = *output.renderer;
+        try {
+            if (!renderer.is_streaming())
+                renderer.write(args.filename);
+            if (!args.jacobian_filename.empty())
+                renderer.write_jacobian(args.jacobian_filename);
+            if (!args.error_map_filename.empty())
+                renderer.write_error_map(args.error_map_filename);
+            if (!args.features_filename.empty())
+                renderer.write_features(args.features_filename);
+            if (!args.cost_filename.empty())
+                renderer.write_cost(args.cost_filename);
+        } catch (const std::exception &e) {
+            // Keep writing the other jobs
+            std::cerr << e.what() << "\n";
+            _failed.push_back(args.filename);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+JobRunner::JobRunner(const CommandLineArguments &args) :
+    _args(args)
+{
+}
+
+void
+JobRunner::run()
+{
+    using namespace std::chrono;
+
+    JsonValue manifest = JsonValue::parse_file(_args.jobs_filename);
+    const JsonValue *jobs = &manifest;
+    if (manifest.is_object())
+        jobs = manifest.find("jobs");
+    if (!jobs || !jobs->is_array())
+        throw std::runtime_error("The job manifest must contain an array of jobs");
+
+    // Two renders in flight is enough to hide the write latency without
+    // holding too many framebuffers in memory.
+    AsyncWriter writer(2);
+
+    auto start = steady_clock::now();
+
+    size_t job_index = 0;
+    for (const JsonValue &job : jobs->items()) {
+        ++job_index;
+
+        auto args = parse_job(job, _args);
+        const std::string &output = args->filename;
+
+        std::cerr << "Job " << job_index << "/" << jobs->items().size()
+                  << " [ " << output << " ]\n";
+
+        Scene shared;
+        shared.atmosphere = _atmospheres.get(*args);
+        auto renderer = std::make_unique<Renderer>(*args, args->main_view(),
+                                                   &shared);
+        render_cached(*renderer, *args);
+        if (args->denoise)
+            renderer->denoise();
+        writer.push(std::move(args), std::move(renderer));
+    }
+    writer.finish();
+
+    std::cerr << "Finished " << job_index << " jobs";
+    print_elapsed_time(steady_clock::now() - start);
+    if (!writer.failed().empty())
+        throw std::runtime_error(std::to_string(writer.failed().size())
+                                 + " jobs could not be written");
+}
@@ -0,0 +1,129 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef JOBS_HXX
+#define JOBS_HXX
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+class Atmosphere;
+class CommandLineArguments;
+class JsonValue;
+class Renderer;
+
+/**
+ * Build the arguments of a job from a JSON object whose keys are long option
+ * names without the leading dashes, e.g.
+ *
+ *   {"elevation": 30, "aerosol-type": "rural", "samples": 64,
+ *    "output": "rural_30.exr"}
+ *
+ * The job options are applied on top of common.base_args. Booleans enable a
+ * flag, arrays repeat an option. Throws std::runtime_error on invalid jobs.
+ */
+std::unique_ptr<CommandLineArguments> parse_job(const JsonValue &job,
+                                                const CommandLineArguments &common);
+
+/**
+ * Atmospheres shared by all the renders with the same atmospheric
+ * parameters. Only the max_size most recently used atmospheres are kept, so
+ * that long-running servers do not grow without bound. Renders keep their
+ * atmosphere alive after it is evicted. Safe to use from several threads.
+ */
+class AtmosphereCache final {
+public:
+    AtmosphereCache(size_t max_size = 16);
+
+    std::shared_ptr<Atmosphere> get(const CommandLineArguments &args);
+private:
+    // Atmospheric model, month, turbidity bits and aerosol type
+    using Key = std::tuple<int, int, uint32_t, std::string>;
+    using Entry = std::pair<Key, std::shared_ptr<Atmosphere>>;
+
+    size_t _max_size;
+    std::mutex _mutex;
+    // Most recently used first
+    std::list<Entry> _entries;
+    std::map<Key, std::list<Entry>::iterator> _index;
+};
+
+/**
+ * Writes finished renders on a background thread, so that EXR encoding and
+ * disk I/O overlap with the rendering of the next job. At most max_pending
+ * renders wait in the queue, which bounds the memory in flight.
+ */
+class AsyncWriter final {
+public:
+    AsyncWriter(size_t max_pending);
+    ~AsyncWriter();
+
+    void push(std::unique_ptr<CommandLineArguments> args,
+              std::unique_ptr<Renderer> renderer);
+    // Wait until everything has been written
+    void finish();
+    // Outputs that could not be written, valid after finish()
+    const std::vector<std::string> &failed() const { return _failed; }
+private:
+    struct Output {
+        std::unique_ptr<CommandLineArguments> args;
+        std::unique_ptr<Renderer> renderer;
+    };
+
+    void loop();
+
+    size_t _max_pending;
+    std::deque<Output> _queue;
+    std::vector<std::string> _failed;
+    bool _done = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::thread _thread;
+};
+
+/**
+ * Render all the jobs of a JSON manifest (--jobs). The manifest is either an
+ * array of jobs or an object with a "jobs" array (see parse_job()). Options
+ * given on the command line apply to every job. Jobs with the same
+ * atmospheric parameters share the same Atmosphere instance. A job whose
+ * output cannot be written does not stop the others, but run() throws
+ * std::runtime_error once they are all done.
+ */
+class JobRunner final {
+public:
+    JobRunner(const CommandLineArguments &args);
+
+    void run();
+private:
+    const CommandLineArguments &_args;
+    AtmosphereCache _atmospheres;
+};
+
+#endif // JOBS_HXX
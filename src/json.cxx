@@ -0,0 +1,231 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "json.hxx"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+class JsonParser final {
+public:
+    JsonParser(const std::string &text) : _text(text), _pos(0) {}
+
+    JsonValue parse_document() {
+        JsonValue value = parse_value();
+        skip_whitespace();
+        if (_pos != _text.size())
+            error("Unexpected trailing characters");
+        return value;
+    }
+private:
+    [[noreturn]] void error(const std::string &message) const {
+        throw std::runtime_error("JSON error at offset " + std::to_string(_pos)
+                                 + ": " + message);
+    }
+
+    void skip_whitespace() {
+        while (_pos < _text.size() && isspace((unsigned char)_text[_pos]))
+            ++_pos;
+    }
+
+    bool consume(char c) {
+        skip_whitespace();
+        if (_pos < _text.size() && _text[_pos] == c) {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c))
+            error(std::string("Expected '") + c + "'");
+    }
+
+    bool consume_literal(const char *literal) {
+        size_t len = std::char_traits<char>::length(literal);
+        if (_text.compare(_pos, len, literal) == 0) {
+            _pos += len;
+            return true;
+        }
+        return false;
+    }
+
+    JsonValue parse_value() {
+        skip_whitespace();
+        if (_pos >= _text.size())
+            error("Unexpected end of input");
+        JsonValue value;
+        char c = _text[_pos];
+        if (c == '{') {
+            ++_pos;
+            value._type = JsonValue::Type::Object;
+            if (consume('}'))
+                return value;
+            do {
+                skip_whitespace();
+                std::string key = parse_string();
+                expect(':');
+                value._members.emplace_back(key, parse_value());
+            } while (consume(','));
+            expect('}');
+        } else if (c == '[') {
+            ++_pos;
+            value._type = JsonValue::Type::Array;
+            if (consume(']'))
+                return value;
+            do {
+                value._items.push_back(parse_value());
+            } while (consume(','));
+            expect(']');
+        } else if (c == '"') {
+            value._type = JsonValue::Type::String;
+            value._string = parse_string();
+        } else if (consume_literal("true")) {
+            value._type = JsonValue::Type::Bool;
+            value._bool = true;
+            value._string = "true";
+        } else if (consume_literal("false")) {
+            value._type = JsonValue::Type::Bool;
+            value._bool = false;
+            value._string = "false";
+        } else if (consume_literal("null")) {
+            value._type = JsonValue::Type::Null;
+        } else if (c == '-' || isdigit((unsigned char)c)) {
+            size_t begin = _pos;
+            while (_pos < _text.size() &&
+                   (isdigit((unsigned char)_text[_pos]) || _text[_pos] == '-' ||
+                    _text[_pos] == '+' || _text[_pos] == '.' ||
+                    _text[_pos] == 'e' || _text[_pos] == 'E'))
+                ++_pos;
+            value._type = JsonValue::Type::Number;
+            value._string = _text.substr(begin, _pos - begin);
+        } else {
+            error(std::string("Unexpected character '") + c + "'");
+        }
+        return value;
+    }
+
+    std::string parse_string() {
+        if (_pos >= _text.size() || _text[_pos] != '"')
+            error("Expected a string");
+        ++_pos;
+        std::string result;
+        while (_pos < _text.size() && _text[_pos] != '"') {
+            char c = _text[_pos++];
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (_pos >= _text.size())
+                break;
+            char e = _text[_pos++];
+            switch (e) {
+            case 'n': result += '\n'; break;
+            case 't': result += '\t'; break;
+            case 'r': result += '\r'; break;
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'u': {
+                // Only code points below 0x80 are supported, which is enough
+                // for file names and option values.
+                if (_pos + 4 > _text.size())
+                    error("Invalid escape sequence");
+                unsigned long code = std::stoul(_text.substr(_pos, 4), nullptr, 16);
+                _pos += 4;
+                if (code >= 0x80)
+                    error("Unsupported non-ASCII escape sequence");
+                result += char(code);
+                break;
+            }
+            default: result += e; break;
+            }
+        }
+        if (_pos >= _text.size())
+            error("Unterminated string");
+        ++_pos;
+        return result;
+    }
+
+    const std::string &_text;
+    size_t _pos;
+};
+
+double
+JsonValue::as_number() const
+{
+    return std::stod(_string);
+}
+
+const JsonValue *
+JsonValue::find(const std::string &key) const
+{
+    for (const auto &member : _members) {
+        if (member.first == key)
+            return &member.second;
+    }
+    return nullptr;
+}
+
+JsonValue
+JsonValue::parse(const std::string &text)
+{
+    JsonParser parser(text);
+    return parser.parse_document();
+}
+
+JsonValue
+JsonValue::parse_file(const std::string &filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+        throw std::runtime_error("Could not open '" + filename + "'");
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return parse(ss.str());
+}
+
+std::string
+json_quote(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text) {
+        switch (c) {
+        case '"': quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+            } else {
+                quoted += c;
+            }
+        }
+    }
+    return quoted + "\"";
+}
@@ -0,0 +1,76 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef JSON_HXX
+#define JSON_HXX
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal JSON document model, enough to read job manifests. Numbers keep
+ * their original text so they can be passed along as command-line arguments
+ * without losing precision.
+ */
+class JsonValue final {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    JsonValue() : _type(Type::Null) {}
+
+    Type type() const { return _type; }
+    bool is_object() const { return _type == Type::Object; }
+    bool is_array() const { return _type == Type::Array; }
+
+    bool as_bool() const { return _bool; }
+    double as_number() const;
+    // Text of a string or number, "true"/"false" for booleans
+    const std::string &as_string() const { return _string; }
+
+    const std::vector<JsonValue> &items() const { return _items; }
+    const std::vector<std::pair<std::string, JsonValue>> &members() const {
+        return _members;
+    }
+    // Return the member with the given key, or nullptr if there is none
+    const JsonValue *find(const std::string &key) const;
+
+    /**
+     * Parse a JSON document. Throws std::runtime_error on syntax errors.
+     */
+    static JsonValue parse(const std::string &text);
+    static JsonValue parse_file(const std::string &filename);
+private:
+    friend class JsonParser;
+
+    Type _type;
+    bool _bool = false;
+    std::string _string;
+    std::vector<JsonValue> _items;
+    std::vector<std::pair<std::string, JsonValue>> _members;
+};
+
+/**
+ * Quote and escape a string for use in a JSON document.
+ */
+std::string json_quote(const std::string &text);
+
+#endif // JSON_HXX
@@ -23,17 +23,96 @@
 #include <iostream>
 
 #include "args.hxx"
+#include "batch.hxx"
+#include "cache.hxx"
+#include "dataset.hxx"
+#include "jobs.hxx"
+#include "pathlog.hxx"
+#include "perf.hxx"
 #include "renderer.hxx"
+#include "server.hxx"
+#include "spectral.hxx"
+#include "stats.hxx"
+#include "trace.hxx"
 
 int main(int argc, char **argv)
 {
     try {
         CommandLineArguments args;
         args.parse_args(argc, argv);
+        if (args.help) {
+            args.print_help(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (args.list_types) {
+            args.list_aerosol_types();
+            return EXIT_SUCCESS;
+        }
 
-        Renderer renderer(args);
-        renderer.render();
-        renderer.write(args.filename);
+        if (!args.trace_filename.empty())
+            start_tracing();
+        if (args.perf_counters)
+            start_perf_counters();
+        if (!args.record_paths_filename.empty())
+            start_path_recording(args);
+        StatsReport stats(args);
+
+        if (!args.socket_path.empty()) {
+            RenderServer server(args);
+            server.run();
+            stats.end_phase("render");
+        } else if (!args.jobs_filename.empty()) {
+            JobRunner runner(args);
+            runner.run();
+            stats.end_phase("render");
+        } else if (!args.dataset_filename.empty()) {
+            DatasetGenerator generator(args);
+            generator.run();
+            stats.end_phase("render");
+        } else if (!args.reconstruct_filename.empty()) {
+            reconstruct_spectral_image(args);
+            stats.end_phase("write");
+        } else if (args.spectral_basis > 0) {
+            SpectralRenderer spectral(args);
+            stats.end_phase("setup");
+            spectral.render();
+            stats.end_phase("render");
+            spectral.write(args.filename);
+            stats.end_phase("write");
+        } else if (!args.views.empty()) {
+            BatchRenderer batch(args);
+            stats.end_phase("setup");
+            batch.render();
+            stats.end_phase("render");
+            batch.write();
+            stats.end_phase("write");
+        } else {
+            Renderer renderer(args);
+            stats.end_phase("setup");
+            render_cached(renderer, args);
+            stats.end_phase("render");
+            if (args.denoise) {
+                renderer.denoise();
+                stats.end_phase("denoise");
+            }
+            if (!renderer.is_streaming())
+                renderer.write(args.filename);
+            if (!args.jacobian_filename.empty())
+                renderer.write_jacobian(args.jacobian_filename);
+            if (!args.error_map_filename.empty())
+                renderer.write_error_map(args.error_map_filename);
+            if (!args.features_filename.empty())
+                renderer.write_features(args.features_filename);
+            if (!args.cost_filename.empty())
+                renderer.write_cost(args.cost_filename);
+            stats.end_phase("write");
+        }
+
+        if (!args.stats_filename.empty())
+            stats.write(args.stats_filename);
+        if (!args.trace_filename.empty())
+            write_trace(args.trace_filename);
+        finish_path_recording();
     } catch(const std::exception &e) {
         std::cerr << std::endl << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -0,0 +1,199 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "metrics.hxx"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <tbb/task_arena.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Resident set size of the process, or -1 if unknown
+int64_t
+resident_memory()
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    int64_t size, resident;
+    if (statm >> size >> resident)
+        return resident * sysconf(_SC_PAGESIZE);
+#endif
+    return -1;
+}
+
+// Escape a label value of the Prometheus text format
+std::string
+escape_label(const std::string &value)
+{
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+double
+unix_time(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration<double>(time.time_since_epoch()).count();
+}
+
+} // anonymous namespace
+
+MetricsExporter::MetricsExporter(const std::string &filename, float interval,
+                                 const std::string &output, size_t total) :
+    _filename(filename),
+    _output(escape_label(output)),
+    _total(total),
+    _start(std::chrono::steady_clock::now()),
+    _thread_count(tbb::this_task_arena::max_concurrency()),
+    _threads(new ThreadSlot[_thread_count]),
+    _last_busy_ns(new int64_t[_thread_count]()),
+    _last_write(_start)
+{
+    _thread = std::thread([this, interval]() {
+        auto period = std::chrono::duration<float>(interval);
+        std::unique_lock lock(_mutex);
+        do {
+            write();
+        } while (!_wakeup.wait_for(lock, period, [this]() { return _finished; }));
+    });
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    finish();
+}
+
+void
+MetricsExporter::add_tile(uint64_t samples,
+                          std::chrono::steady_clock::duration busy)
+{
+    _done.fetch_add(1, std::memory_order_relaxed);
+    _samples.fetch_add(samples, std::memory_order_relaxed);
+    int slot = tbb::this_task_arena::current_thread_index();
+    if (slot >= 0 && slot < _thread_count) {
+        _threads[slot].busy_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(),
+            std::memory_order_relaxed);
+    }
+}
+
+void
+MetricsExporter::finish()
+{
+    if (!_thread.joinable())
+        return;
+    {
+        std::scoped_lock lock(_mutex);
+        _finished = true;
+    }
+    _wakeup.notify_one();
+    _thread.join();
+    write();
+}
+
+void
+MetricsExporter::write()
+{
+    using namespace std::chrono;
+
+    auto now = steady_clock::now();
+    auto wall_now = system_clock::now();
+    double elapsed = duration<double>(now - _start).count();
+    double interval = duration<double>(now - _last_write).count();
+    _last_write = now;
+    size_t done = _done.load(std::memory_order_relaxed);
+    uint64_t samples = _samples.load(std::memory_order_relaxed);
+    double progress = _total > 0 ? double(done) / _total : 1.0;
+    std::string label = "output=\"" + _output + "\"";
+
+    // Write to a temporary file and rename it, as the collector may read the
+    // file at any time
+    std::string tmp = _filename + ".tmp";
+    {
+        std::ofstream out(tmp);
+        out.precision(12);
+        out << "# HELP skytracer_samples_total Samples traced so far.\n"
+            << "# TYPE skytracer_samples_total counter\n"
+            << "skytracer_samples_total{" << label << "} " << samples << "\n"
+            << "# HELP skytracer_samples_per_second Mean samples per second since the render started.\n"
+            << "# TYPE skytracer_samples_per_second gauge\n"
+            << "skytracer_samples_per_second{" << label << "} "
+            << (elapsed > 0.0 ? samples / elapsed : 0.0) << "\n"
+            << "# HELP skytracer_tiles_total Tiles of the render.\n"
+            << "# TYPE skytracer_tiles_total gauge\n"
+            << "skytracer_tiles_total{" << label << "} " << _total << "\n"
+            << "# HELP skytracer_tiles_remaining Tiles that are not done yet.\n"
+            << "# TYPE skytracer_tiles_remaining gauge\n"
+            << "skytracer_tiles_remaining{" << label << "} " << _total - done
+            << "\n";
+        int64_t rss = resident_memory();
+        if (rss >= 0) {
+            out << "# HELP skytracer_resident_memory_bytes Resident set size of the process.\n"
+                << "# TYPE skytracer_resident_memory_bytes gauge\n"
+                << "skytracer_resident_memory_bytes{" << label << "} " << rss
+                << "\n";
+        }
+        // Assume the remaining tiles go as fast as the tiles done so far
+        if (done > 0) {
+            double remaining = elapsed * (1.0 - progress) / progress;
+            out << "# HELP skytracer_estimated_completion_timestamp_seconds Estimated Unix time at which the render ends.\n"
+                << "# TYPE skytracer_estimated_completion_timestamp_seconds gauge\n"
+                << "skytracer_estimated_completion_timestamp_seconds{" << label
+                << "} " << unix_time(wall_now) + remaining << "\n";
+        }
+        out << "# HELP skytracer_thread_busy_ratio Fraction of the last interval each thread spent rendering tiles.\n"
+            << "# TYPE skytracer_thread_busy_ratio gauge\n";
+        for (int i = 0; i < _thread_count; ++i) {
+            int64_t busy = _threads[i].busy_ns.load(std::memory_order_relaxed);
+            double ratio = interval > 0.0
+                ? (busy - _last_busy_ns[i]) * 1e-9 / interval : 0.0;
+            _last_busy_ns[i] = busy;
+            out << "skytracer_thread_busy_ratio{" << label << ",thread=\"" << i
+                << "\"} " << std::min(ratio, 1.0) << "\n";
+        }
+        out << "# HELP skytracer_last_update_timestamp_seconds Unix time at which this file was written.\n"
+            << "# TYPE skytracer_last_update_timestamp_seconds gauge\n"
+            << "skytracer_last_update_timestamp_seconds{" << label << "} "
+            << unix_time(wall_now) << "\n";
+        if (!out) {
+            std::cerr << "Failed to write the metrics file " << tmp << "\n";
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp, _filename, error);
+    if (error)
+        std::cerr << "Failed to update the metrics file " << _filename << ": "
+                  << error.message() << "\n";
+}
@@ -0,0 +1,83 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef METRICS_HXX
+#define METRICS_HXX
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Writes the state of a render to a Prometheus textfile (--metrics) every
+ * few seconds, for the textfile collector of node_exporter. The file is
+ * replaced atomically, so the collector never reads a partial file.
+ *
+ * Like ProgressReporter, the rendering threads only add to atomic counters.
+ * Their busy time is kept in one slot per TBB thread, so that the busy
+ * fraction of every thread can be exported.
+ */
+class MetricsExporter final {
+public:
+    /**
+     * Start exporting. output labels the metrics and total is the number of
+     * tiles to render.
+     */
+    MetricsExporter(const std::string &filename, float interval,
+                    const std::string &output, size_t total);
+    ~MetricsExporter();
+
+    // Called by the rendering threads when a tile is done
+    void add_tile(uint64_t samples, std::chrono::steady_clock::duration busy);
+    // Stop the exporting thread and write the final state
+    void finish();
+private:
+    // Padded so that threads do not share cache lines
+    struct alignas(64) ThreadSlot {
+        std::atomic<int64_t> busy_ns{0};
+    };
+
+    void write();
+
+    std::string _filename;
+    std::string _output;
+    size_t _total;
+    std::chrono::steady_clock::time_point _start;
+    std::atomic<size_t> _done{0};
+    std::atomic<uint64_t> _samples{0};
+    int _thread_count;
+    std::unique_ptr<ThreadSlot[]> _threads;
+    // Busy time of every thread and time of the previous write, to compute
+    // the busy fraction since then
+    std::unique_ptr<int64_t[]> _last_busy_ns;
+    std::chrono::steady_clock::time_point _last_write;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    bool _finished = false;
+};
+
+#endif // METRICS_HXX
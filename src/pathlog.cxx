@@ -0,0 +1,167 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "pathlog.hxx"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <tbb/enumerable_thread_specific.h>
+
+#include "args.hxx"
+
+std::atomic<bool> path_recording_enabled{false};
+
+namespace {
+
+// Bytes buffered by every thread before they are appended to the log
+const size_t FLUSH_SIZE = 1 << 20;
+
+struct ThreadPaths {
+    RecordedPath path;
+    bool recording = false;
+    std::vector<char> buffer;
+};
+
+tbb::enumerable_thread_specific<ThreadPaths> threads;
+
+std::mutex log_mutex;
+FILE *log_file = nullptr;
+uint64_t record_every = 1;
+// Recorded pixels as (x, y) pairs, empty to sample paths of every pixel
+std::vector<std::pair<int, int>> record_pixels;
+
+void
+flush(std::vector<char> &buffer)
+{
+    if (buffer.empty())
+        return;
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (log_file)
+        fwrite(buffer.data(), 1, buffer.size(), log_file);
+    buffer.clear();
+}
+
+void
+append(std::vector<char> &buffer, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+} // anonymous namespace
+
+void
+RecordedPath::add_vertex(PathVertexType type, const glm::vec3 &position,
+                         float throughput)
+{
+    if (_vertices.size() >= MAX_VERTICES) {
+        _path.truncated = 1;
+        return;
+    }
+    _vertices.push_back({{position.x, position.y, position.z},
+                         throughput, 0.0f, type});
+}
+
+void
+RecordedPath::add_contribution(float contribution)
+{
+    if (!_vertices.empty() && !_path.truncated)
+        _vertices.back().contribution += contribution;
+}
+
+void
+start_path_recording(const CommandLineArguments &args)
+{
+    log_file = fopen(args.record_paths_filename.c_str(), "wb");
+    if (!log_file)
+        throw std::runtime_error("Could not open "
+                                 + args.record_paths_filename);
+    PathLogHeader header;
+    std::memcpy(header.magic, "SKYPATHS", 8);
+    header.version = 1;
+    header.vertex_size = sizeof(PathLogVertex);
+    fwrite(&header, sizeof(header), 1, log_file);
+
+    record_every = std::max(args.record_every, 1);
+    record_pixels = args.record_pixels;
+    path_recording_enabled = true;
+}
+
+void
+finish_path_recording()
+{
+    if (!log_file)
+        return;
+    path_recording_enabled = false;
+    for (ThreadPaths &thread : threads)
+        flush(thread.buffer);
+    bool failed = ferror(log_file) != 0;
+    failed |= fclose(log_file) != 0;
+    log_file = nullptr;
+    if (failed)
+        throw std::runtime_error("Could not write the path log");
+}
+
+void
+begin_path(int x, int y, int sample, uint64_t index, float wl)
+{
+    bool selected;
+    if (record_pixels.empty()) {
+        selected = index % record_every == 0;
+    } else {
+        selected = std::find(record_pixels.begin(), record_pixels.end(),
+                             std::make_pair(x, y)) != record_pixels.end();
+    }
+    ThreadPaths &thread = threads.local();
+    thread.recording = selected;
+    if (!selected)
+        return;
+    RecordedPath &path = thread.path;
+    path._path = PathLogPath{uint32_t(x), uint32_t(y), uint32_t(sample), 0,
+                             wl, 0.0f, PathEnd::ESCAPED, 0};
+    path._vertices.clear();
+}
+
+void
+end_path(float radiance)
+{
+    ThreadPaths &thread = threads.local();
+    if (!thread.recording)
+        return;
+    thread.recording = false;
+    RecordedPath &path = thread.path;
+    path._path.radiance = radiance;
+    path._path.vertex_count = uint32_t(path._vertices.size());
+    append(thread.buffer, &path._path, sizeof(PathLogPath));
+    append(thread.buffer, path._vertices.data(),
+           path._vertices.size() * sizeof(PathLogVertex));
+    if (thread.buffer.size() >= FLUSH_SIZE)
+        flush(thread.buffer);
+}
+
+RecordedPath *
+recorded_path()
+{
+    ThreadPaths &thread = threads.local();
+    return thread.recording ? &thread.path : nullptr;
+}
@@ -0,0 +1,128 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef PATHLOG_HXX
+#define PATHLOG_HXX
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "common.hxx"
+
+class CommandLineArguments;
+
+/**
+ * Log of sampled paths for offline analysis (--record-paths). Either 1 in
+ * every --record-every paths or every path of the pixels given by
+ * --record-pixel is recorded. Every thread fills its own buffer, which is
+ * appended to the log when it is full, so paths from different threads are
+ * interleaved but never split. scripts/path_log.py converts the log to CSV or
+ * PLY.
+ *
+ * The log starts with a PathLogHeader. Each path is a PathLogPath followed by
+ * its vertex_count PathLogVertex, all of them little-endian.
+ */
+
+struct PathLogHeader {
+    char magic[8];      // "SKYPATHS"
+    uint32_t version;
+    uint32_t vertex_size;
+};
+
+enum class PathEnd : uint32_t {
+    // Left the atmosphere or looked into outer space
+    ESCAPED,
+    ABSORBED,
+    // Russian roulette or no throughput left
+    TERMINATED,
+    // Reached --max-order
+    MAX_ORDER
+};
+
+struct PathLogPath {
+    uint32_t x, y;
+    uint32_t sample;
+    uint32_t vertex_count;
+    float wavelength;
+    // Radiance estimate of the whole path
+    float radiance;
+    PathEnd end;
+    // 1 if the path had more vertices than were recorded
+    uint32_t truncated;
+};
+
+enum class PathVertexType : uint32_t {
+    CAMERA,
+    SCATTERING,
+    GROUND,
+    ABSORPTION,
+    // Last point of the path inside the atmosphere
+    EXIT
+};
+
+struct PathLogVertex {
+    float position[3];
+    // Path throughput when reaching the vertex
+    float throughput;
+    // Radiance added by next event estimation at the vertex
+    float contribution;
+    PathVertexType type;
+};
+
+extern std::atomic<bool> path_recording_enabled;
+
+/**
+ * Path of the calling thread that is being recorded. The integrator adds its
+ * vertices while tracing it.
+ */
+class RecordedPath final {
+public:
+    // Paths longer than this are truncated
+    static const uint32_t MAX_VERTICES = 1024;
+
+    void add_vertex(PathVertexType type, const glm::vec3 &position,
+                    float throughput);
+    // Record the contribution of the last vertex
+    void add_contribution(float contribution);
+    void set_end(PathEnd end) { _path.end = end; }
+private:
+    friend void begin_path(int, int, int, uint64_t, float);
+    friend void end_path(float);
+
+    PathLogPath _path;
+    std::vector<PathLogVertex> _vertices;
+};
+
+// Open the log and enable recording. Throws if the log cannot be created.
+void start_path_recording(const CommandLineArguments &args);
+// Write the paths still buffered and close the log
+void finish_path_recording();
+
+/**
+ * Called around every sample by the renderer. index identifies the path in
+ * the image and selects 1 in every --record-every paths.
+ */
+void begin_path(int x, int y, int sample, uint64_t index, float wl);
+void end_path(float radiance);
+// Path being recorded by the calling thread, or null if it is not recorded
+RecordedPath *recorded_path();
+
+#endif // PATHLOG_HXX
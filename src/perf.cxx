@@ -0,0 +1,237 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "perf.hxx"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <tbb/enumerable_thread_specific.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<bool> perf_counters_enabled{false};
+
+namespace {
+
+const char *EVENT_NAMES[PerfCounters::EVENT_COUNT] = {
+    "cycles",
+    "instructions",
+    "cache_references",
+    "cache_misses",
+    "branches",
+    "branch_misses",
+    "stalled_cycles_frontend",
+    "stalled_cycles_backend"
+};
+
+// Events that could be opened by start_perf_counters()
+bool available[PerfCounters::EVENT_COUNT] = {};
+
+PerfCounters
+unavailable_counters()
+{
+    PerfCounters counters;
+    for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i)
+        counters.values[i] = -1;
+    return counters;
+}
+
+#ifdef __linux__
+
+const uint64_t EVENT_CONFIGS[PerfCounters::EVENT_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_STALLED_CYCLES_FRONTEND,
+    PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+};
+
+// Count an event of the calling thread in user space. Returns -1 on error.
+int
+open_event(int event)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = EVENT_CONFIGS[event];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The events are not grouped, so the kernel may multiplex them when there
+    // are not enough hardware counters. The values are scaled by the fraction
+    // of time each event was actually counted.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                     | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+#endif
+
+struct ThreadPerf {
+    ThreadPerf() {
+        for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+#ifdef __linux__
+            fds[i] = available[i] ? open_event(i) : -1;
+#else
+            fds[i] = -1;
+#endif
+            totals.values[i] = fds[i] >= 0 ? 0 : -1;
+        }
+    }
+    ~ThreadPerf() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+    ThreadPerf(const ThreadPerf &) = delete;
+    ThreadPerf &operator=(const ThreadPerf &) = delete;
+
+    // Read the value, time enabled and time running of an event
+    bool read_event(int event, uint64_t values[3]) const {
+#ifdef __linux__
+        return fds[event] >= 0
+            && read(fds[event], values, 3 * sizeof(uint64_t))
+               == ssize_t(3 * sizeof(uint64_t));
+#else
+        return false;
+#endif
+    }
+
+    int fds[PerfCounters::EVENT_COUNT];
+    PerfCounters totals;
+};
+
+tbb::enumerable_thread_specific<ThreadPerf> threads;
+
+} // anonymous namespace
+
+void
+PerfCounters::add(const PerfCounters &other)
+{
+    for (int i = 0; i < EVENT_COUNT; ++i) {
+        if (other.values[i] >= 0)
+            values[i] = std::max<int64_t>(values[i], 0) + other.values[i];
+    }
+}
+
+double
+PerfCounters::ratio(Event numerator, Event denominator) const
+{
+    if (values[numerator] < 0 || values[denominator] <= 0)
+        return -1.0;
+    return double(values[numerator]) / double(values[denominator]);
+}
+
+void
+start_perf_counters()
+{
+#ifdef __linux__
+    int opened = 0;
+    int error = 0;
+    for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+        int fd = open_event(i);
+        if (fd >= 0) {
+            close(fd);
+            available[i] = true;
+            ++opened;
+        } else {
+            error = errno;
+        }
+    }
+    if (opened == 0)
+        throw std::runtime_error(
+            std::string("Hardware performance counters are not available: ")
+            + std::strerror(error)
+            + ". Check /proc/sys/kernel/perf_event_paranoid");
+    for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+        if (!available[i])
+            std::cerr << "The " << EVENT_NAMES[i]
+                      << " event cannot be counted on this machine\n";
+    }
+    perf_counters_enabled = true;
+#else
+    throw std::runtime_error("Hardware performance counters are only "
+                             "supported on Linux");
+#endif
+}
+
+PerfCounters
+total_perf_counters()
+{
+    PerfCounters total = unavailable_counters();
+    for (const ThreadPerf &thread : threads)
+        total.add(thread.totals);
+    return total;
+}
+
+const char *
+perf_event_name(int event)
+{
+    return EVENT_NAMES[event];
+}
+
+//------------------------------------------------------------------------------
+
+PerfScope::PerfScope() :
+    _enabled(perf_counters_enabled.load(std::memory_order_relaxed)),
+    _counters(unavailable_counters())
+{
+    if (!_enabled)
+        return;
+    const ThreadPerf &thread = threads.local();
+    for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+        if (!thread.read_event(i, _start[i]))
+            _start[i][0] = _start[i][1] = _start[i][2] = 0;
+    }
+}
+
+void
+PerfScope::stop()
+{
+    if (!_enabled || _stopped)
+        return;
+    _stopped = true;
+    ThreadPerf &thread = threads.local();
+    for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+        uint64_t end[3];
+        if (!thread.read_event(i, end))
+            continue;
+        uint64_t value = end[0] - _start[i][0];
+        uint64_t enabled = end[1] - _start[i][1];
+        uint64_t running = end[2] - _start[i][2];
+        _counters.values[i] = running > 0
+            ? int64_t(double(value) * double(enabled) / double(running)) : 0;
+    }
+    thread.totals.add(_counters);
+}
@@ -0,0 +1,87 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#ifndef PERF_HXX
+#define PERF_HXX
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Hardware performance counters of the render work (--perf-counters), read
+ * with perf_event_open on Linux. Every thread counts its own events, which are
+ * added up around each tile, so the totals only include rendering and not the
+ * rest of the run.
+ */
+struct PerfCounters {
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_REFERENCES,
+        CACHE_MISSES,
+        BRANCHES,
+        BRANCH_MISSES,
+        STALLED_CYCLES_FRONTEND,
+        STALLED_CYCLES_BACKEND,
+        EVENT_COUNT
+    };
+
+    // Negative if the event cannot be counted on this machine
+    int64_t values[EVENT_COUNT];
+
+    void add(const PerfCounters &other);
+    // Ratio of two events, negative if either of them is not available
+    double ratio(Event numerator, Event denominator) const;
+};
+
+extern std::atomic<bool> perf_counters_enabled;
+
+/**
+ * Check which events can be counted and enable the counters. Throws if none
+ * of them can, e.g. in virtual machines or when perf_event_paranoid forbids
+ * it.
+ */
+void start_perf_counters();
+// Sum of the counters of every thread
+PerfCounters total_perf_counters();
+// Name of an event in the stats report
+const char *perf_event_name(int event);
+
+/**
+ * Counts the events of the calling thread from its construction until stop()
+ * or its destruction, if the counters are enabled.
+ */
+class PerfScope final {
+public:
+    PerfScope();
+    ~PerfScope() { stop(); }
+    // Stop counting and add the events to the totals of the thread
+    void stop();
+    // Events counted after stop(), or negative values if disabled
+    const PerfCounters &counters() const { return _counters; }
+private:
+    bool _enabled;
+    bool _stopped = false;
+    PerfCounters _counters;
+    // Raw values, time enabled and time running of every event at the start
+    uint64_t _start[PerfCounters::EVENT_COUNT][3];
+};
+
+#endif // PERF_HXX
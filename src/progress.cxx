@@ -0,0 +1,176 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "progress.hxx"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+void
+update_progress_bar(int count, int total)
+{
+    const int bar_width = 50;
+    float progress = float(count) / total;
+    int pos = progress * bar_width;
+    std::cerr << "\rRendering [";
+    for (int i = 0; i < bar_width; ++i) {
+        if (i < pos) std::cerr << '=';
+        else if (i == pos) std::cerr << '>';
+        else std::cerr << ' ';
+    }
+    std::cerr << "] ";
+    int percent = progress * 100.0f;
+    if (percent < 10) std::cerr << "  ";
+    else if (percent < 100) std::cerr << " ";
+    std::cerr << percent << "%" << std::flush;
+}
+
+void
+print_elapsed_time(std::chrono::steady_clock::duration elapsed)
+{
+    using namespace std::chrono;
+
+    auto hrs = duration_cast<hours>(elapsed);
+    auto mins = duration_cast<minutes>(elapsed - hrs);
+    auto secs = duration_cast<seconds>(elapsed - hrs - mins);
+
+    std::cerr << " (";
+    if (hrs.count() != 0) std::cerr << hrs.count() << "h ";
+    if (mins.count() != 0) std::cerr << mins.count() << "m ";
+    std::cerr << secs.count() << "s)\n";
+}
+
+namespace {
+
+// Write a duration in seconds as "1h 2m 3s"
+std::string
+format_duration(double seconds)
+{
+    long total = long(seconds + 0.5);
+    std::ostringstream out;
+    if (total >= 3600) out << total / 3600 << "h ";
+    if (total >= 60) out << total / 60 % 60 << "m ";
+    out << total % 60 << "s";
+    return out.str();
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+ProgressReporter::Format
+ProgressReporter::parse_format(const std::string &name)
+{
+    if (name == "bar")
+        return Format::BAR;
+    if (name == "json")
+        return Format::JSON;
+    throw std::runtime_error("Unknown progress format '" + name
+                             + "'. Use bar or json");
+}
+
+ProgressReporter::ProgressReporter(Format format, float interval,
+                                   size_t total) :
+    _format(format),
+    _total(total),
+    _start(std::chrono::steady_clock::now())
+{
+    _thread = std::thread([this, interval]() {
+        auto period = std::chrono::duration<float>(interval);
+        std::unique_lock lock(_mutex);
+        do {
+            report(false);
+        } while (!_wakeup.wait_for(lock, period, [this]() { return _finished; }));
+    });
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    finish();
+}
+
+void
+ProgressReporter::finish()
+{
+    if (!_thread.joinable())
+        return;
+    {
+        std::scoped_lock lock(_mutex);
+        _finished = true;
+    }
+    _wakeup.notify_one();
+    _thread.join();
+    report(true);
+}
+
+void
+ProgressReporter::report(bool last)
+{
+    using namespace std::chrono;
+
+    double elapsed =
+        duration<double>(steady_clock::now() - _start).count();
+    size_t done = _done.load(std::memory_order_relaxed);
+    uint64_t samples = _samples.load(std::memory_order_relaxed);
+    uint64_t paths = _paths.load(std::memory_order_relaxed);
+    double progress = _total > 0 ? double(done) / _total : 1.0;
+    double samples_per_second = elapsed > 0.0 ? samples / elapsed : 0.0;
+    double paths_per_second = elapsed > 0.0 ? paths / elapsed : 0.0;
+    // Assume the remaining work goes as fast as the work done so far
+    double eta = progress > 0.0 ? elapsed * (1.0 - progress) / progress : -1.0;
+
+    if (_format == Format::JSON) {
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(3)
+             << "{\"progress\": " << progress
+             << ", \"done\": " << done
+             << ", \"total\": " << _total
+             << ", \"samples\": " << samples
+             << ", \"paths\": " << paths
+             << ", \"samples_per_second\": " << samples_per_second
+             << ", \"paths_per_second\": " << paths_per_second
+             << ", \"elapsed\": " << elapsed
+             << ", \"eta\": ";
+        if (eta >= 0.0)
+            line << eta;
+        else
+            line << "null";
+        line << ", \"finished\": " << (last ? "true" : "false") << "}\n";
+        std::cerr << line.str() << std::flush;
+        return;
+    }
+
+    update_progress_bar(int(done), int(_total));
+    std::cerr << std::fixed << std::setprecision(1)
+              << "  " << samples_per_second * 1e-6 << " Msamples/s  "
+              << paths_per_second * 1e-6 << " Mpaths/s";
+    std::cerr.unsetf(std::ios::floatfield);
+    // Padded to erase a longer ETA from the previous update
+    std::string trailer;
+    if (last)
+        trailer = "(" + format_duration(elapsed) + ")";
+    else
+        trailer = "ETA " + (eta >= 0.0 ? format_duration(eta) : "-");
+    std::cerr << "  " << std::left << std::setw(16) << trailer << std::right
+              << (last ? "\n" : "") << std::flush;
+}
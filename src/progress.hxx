@@ -0,0 +1,91 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef PROGRESS_HXX
+#define PROGRESS_HXX
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Redraw the progress bar on stderr.
+ */
+void update_progress_bar(int count, int total);
+
+/**
+ * Reports the progress of a render on stderr from its own thread, at a fixed
+ * interval. The rendering threads only add to atomic counters, so they never
+ * wait for each other or for the output.
+ */
+class ProgressReporter final {
+public:
+    enum class Format {
+        // Progress bar with the throughput and the remaining time
+        BAR,
+        // One JSON object per line, to be read by other programs
+        JSON
+    };
+
+    // Throws if name is not a known format
+    static Format parse_format(const std::string &name);
+
+    /**
+     * Start reporting. total is the number of work items (tiles or images)
+     * to be done.
+     */
+    ProgressReporter(Format format, float interval, size_t total);
+    ~ProgressReporter();
+
+    // Called when work items are done, with the samples and paths they traced
+    void add(size_t done, uint64_t samples, uint64_t paths) {
+        _done.fetch_add(done, std::memory_order_relaxed);
+        _samples.fetch_add(samples, std::memory_order_relaxed);
+        _paths.fetch_add(paths, std::memory_order_relaxed);
+    }
+    // Stop the reporting thread and report the final state
+    void finish();
+private:
+    void report(bool last);
+
+    Format _format;
+    size_t _total;
+    std::chrono::steady_clock::time_point _start;
+    std::atomic<size_t> _done{0};
+    std::atomic<uint64_t> _samples{0};
+    std::atomic<uint64_t> _paths{0};
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    bool _finished = false;
+};
+
+/**
+ * Print an elapsed time as " (1h 2m 3s)" and end the line.
+ */
+void print_elapsed_time(std::chrono::steady_clock::duration elapsed);
+
+#endif // PROGRESS_HXX
@@ -21,7 +21,10 @@
 
 #include "renderer.hxx"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
@@ -30,51 +33,102 @@
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 
-#include <zlib.h>
-#define TINYEXR_USE_MINIZ 0
-#define TINYEXR_IMPLEMENTATION
-#include "tinyexr.h"
-
 #include "args.hxx"
+#include "denoiser.hxx"
+#include "exr.hxx"
+#include "metrics.hxx"
+#include "pathlog.hxx"
+#include "perf.hxx"
+#include "progress.hxx"
 #include "sampler.hxx"
+#include "stats.hxx"
+#include "trace.hxx"
 
 using namespace glm;
 
-namespace {
-
-void
-update_progress_bar(int count, int total)
+Renderer::Renderer(const CommandLineArguments &args) :
+    Renderer(args, args.main_view(), nullptr)
 {
-    const int bar_width = 50;
-    float progress = float(count) / total;
-    int pos = progress * bar_width;
-    std::cerr << "\rRendering [";
-    for (int i = 0; i < bar_width; ++i) {
-        if (i < pos) std::cerr << '=';
-        else if (i == pos) std::cerr << '>';
-        else std::cerr << ' ';
-    }
-    std::cerr << "] ";
-    int percent = progress * 100.0f;
-    if (percent < 10) std::cerr << "  ";
-    else if (percent < 100) std::cerr << " ";
-    std::cerr << percent << "%" << std::flush;
 }
 
-} // anonymous namespace
-
-Renderer::Renderer(const CommandLineArguments &args) :
+Renderer::Renderer(const CommandLineArguments &args, const CameraView &view,
+                   const Scene *shared_scene) :
     _image_width(args.width),
     _image_height(args.height),
     _tile_width(args.tile_width),
     _tile_height(args.tile_height),
     _wavelength(args.wavelength),
     _samples_per_pixel(args.samples),
-    _inv_image_size(1.0f / float(args.width), 1.0f / float(args.height))
+    _adaptive_step(args.adaptive ? args.adaptive_step : 0),
+    _adaptive_threshold(args.adaptive_threshold),
+    _compute_features(args.denoise || !args.features_filename.empty()),
+    _compute_variance(_compute_features || !args.cache_directory.empty()),
+    _compute_cost(!args.cost_filename.empty()),
+    _denoise_radius(args.denoise_radius),
+    _denoise_strength(args.denoise_strength),
+    _inv_image_size(1.0f / float(args.width), 1.0f / float(args.height)),
+    _eye_altitude(view.eye_altitude),
+    _verbose(!args.quiet),
+    _progress_format(ProgressReporter::parse_format(args.progress_format)),
+    _progress_interval(args.progress_interval),
+    _metrics_filename(args.metrics_filename),
+    _metrics_interval(args.metrics_interval),
+    _output_filename(view.filename),
+    _exr_options{args.half_float, parse_exr_compression(args.compression)},
+    _window(0, args.width, 0, args.height),
+    _publish_interval(args.publish_interval)
 {
-    _buffer.resize(_image_width * _image_height);
+    if (args.crop_width > 0 && args.crop_height > 0) {
+        _window = Tile(args.crop_x, args.crop_x + args.crop_width,
+                       args.crop_y, args.crop_y + args.crop_height);
+        if (_window.x0 < 0 || _window.x1 > _image_width ||
+            _window.y0 < 0 || _window.y1 > _image_height)
+            throw std::runtime_error("The crop window must be inside the image");
+    }
+    if (args.stream) {
+        if (_adaptive_step > 0 || _compute_features || _compute_variance
+            || !args.error_map_filename.empty() || _compute_cost)
+            throw std::runtime_error("Streaming output cannot be combined with "
+                                     "adaptive sampling, denoising, features, "
+                                     "cost maps or the render cache");
+        _stream_filename = view.filename;
+    } else {
+        _buffer.resize(size_t(_window.width()) * _window.height());
+    }
+    if (_compute_variance)
+        _features.variance.resize(_buffer.size());
+    if (_compute_cost) {
+        _cost_time.resize(_buffer.size());
+        _cost_null_collisions.resize(_buffer.size());
+        _cost_path_length.resize(_buffer.size());
+    }
+    if (_compute_features) {
+        _features.view_zenith.resize(_buffer.size());
+        _features.optical_depth.resize(_buffer.size());
+    }
+    if (_adaptive_step > 0 && (_adaptive_step & (_adaptive_step - 1)) != 0)
+        throw std::runtime_error("The adaptive step must be a power of two");
+    if (!args.publish_target.empty()) {
+        if (args.stream)
+            throw std::runtime_error("Frames cannot be published when "
+                                     "streaming the output");
+        const std::string &target = args.publish_target;
+        if (target.compare(0, 4, "shm:") == 0)
+            _publisher = std::make_unique<SharedMemoryFramePublisher>(
+                target.substr(4), _window.width(), _window.height());
+        else
+            _publisher = std::make_unique<PipeFramePublisher>(
+                target, _window.width(), _window.height());
+    }
     prepare_tiles();
-    create_scene(args);
+    create_scene(args, view, shared_scene);
+    // Symmetry is skipped when the adaptive sampler picks its own pixels, as
+    // it cannot skip the symmetric ones; when streaming, as tiles are gone
+    // before their symmetric pixels could be copied; and when recording
+    // selected pixels, as pixels copied by symmetry are never traced.
+    if (args.symmetry && _adaptive_step == 0 && !args.stream
+        && args.record_pixels.empty())
+        detect_symmetry(args, view);
 }
 
 void
@@ -82,92 +136,446 @@ Renderer::render()
 {
     using namespace std::chrono;
 
+    TraceScope trace("render", "renderer");
+
     tbb::blocked_range<size_t> range(0, _tiles.size());
 
-    std::mutex progress_mutex;
-    size_t progress_count = 0;
-    update_progress_bar(0, _tiles.size());
+    _cancelled = false;
+    _tiles_done = 0;
+    // The framebuffer may have been taken by the previous render
+    if (!is_streaming() && _buffer.empty())
+        _buffer.resize(size_t(_window.width()) * _window.height());
+
+    std::unique_ptr<TiledExrWriter> writer;
+    if (is_streaming()) {
+        writer = std::make_unique<TiledExrWriter>(
+            _stream_filename, _window.x0, _window.y0, _window.width(),
+            _window.height(), _image_width, _image_height, _tile_width,
+            _tile_height, std::vector<std::string>{"A", "variance"},
+            _exr_options);
+    }
+
+    // Tiles are only copied to the published frames once they are done, so
+    // the publisher never reads pixels that are being written.
+    std::unique_ptr<std::atomic<bool>[]> tiles_done;
+    std::thread publisher;
+    std::mutex publisher_mutex;
+    std::condition_variable publisher_wakeup;
+    bool rendering = true;
+    if (_publisher && _adaptive_step == 0) {
+        tiles_done.reset(new std::atomic<bool>[_tiles.size()]);
+        for (size_t i = 0; i < _tiles.size(); ++i)
+            tiles_done[i] = false;
+        publisher = std::thread([&]() {
+            std::vector<bool> tiles_copied(_tiles.size(), false);
+            std::vector<float> frame(_buffer.size(), 0.0f);
+            auto interval = duration<float>(_publish_interval);
+            std::unique_lock lock(publisher_mutex);
+            while (!publisher_wakeup.wait_for(lock, interval,
+                                              [&]() { return !rendering; }))
+                publish_frame(tiles_done.get(), tiles_copied, frame);
+        });
+    }
+
+    // Adaptive sampling reports its own progress
+    std::unique_ptr<ProgressReporter> progress;
+    if (_verbose && _adaptive_step == 0) {
+        progress = std::make_unique<ProgressReporter>(
+            _progress_format, _progress_interval, _tiles.size());
+    }
+    std::unique_ptr<MetricsExporter> metrics;
+    if (!_metrics_filename.empty() && _adaptive_step == 0) {
+        metrics = std::make_unique<MetricsExporter>(
+            _metrics_filename, _metrics_interval, _output_filename,
+            _tiles.size());
+    }
 
     auto kernel = [&](const tbb::blocked_range<size_t> &range) {
-        Sampler sampler(range.begin(), range.end());
+        Sampler sampler(range.begin(), range.end(), _seed);
+        const RenderCounters &counters = thread_counters();
         for (size_t i = range.begin(); i < range.end(); ++i) {
-            render_tile(&sampler, _tiles[i]);
+            if (_cancel_requested)
+                return;
+            uint64_t camera_rays = counters.camera_rays;
+            auto tile_start = steady_clock::now();
+            int64_t samples = writer
+                ? stream_tile(&sampler, _tiles[i], *writer)
+                : render_tile(&sampler, _tiles[i]);
+            if (tiles_done)
+                tiles_done[i].store(true, std::memory_order_release);
 
-            std::scoped_lock lock(progress_mutex);
-            ++progress_count;
-            update_progress_bar(progress_count, _tiles.size());
+            ++_tiles_done;
+            if (progress)
+                progress->add(1, samples, counters.camera_rays - camera_rays);
+            if (metrics)
+                metrics->add_tile(samples, steady_clock::now() - tile_start);
         }
     };
 
-    auto start = steady_clock::now();
+    if (_adaptive_step > 0) {
+        auto start = steady_clock::now();
+        render_adaptive();
+        _tiles_done = _tiles.size();
+        if (_verbose)
+            print_elapsed_time(steady_clock::now() - start);
+    } else {
+        // Run the kernel
+        tbb::parallel_for(range, kernel);
+    }
+    // The request is consumed by this render, even if it came after the last
+    // tile, so that it does not cancel the next one.
+    _cancelled = _cancel_requested.exchange(false);
+    if (progress)
+        progress->finish();
+    if (metrics)
+        metrics->finish();
+    if (publisher.joinable()) {
+        {
+            std::scoped_lock lock(publisher_mutex);
+            rendering = false;
+        }
+        publisher_wakeup.notify_one();
+        publisher.join();
+    }
+    if (writer) {
+        writer->finish();
+        if (_verbose && !_cancelled)
+            std::cerr << "Saved tiled EXR image [ " << _stream_filename
+                      << " ] (" << writer->bytes_written() << " bytes)\n";
+    }
+    if (_cancelled) {
+        if (_verbose)
+            std::cerr << "Rendering cancelled\n";
+        return;
+    }
 
-    // Run the kernel
-    tbb::parallel_for(range, kernel);
+    finish_render();
+    if (_publisher)
+        _publisher->publish(_buffer.data(), 1.0f);
+}
 
-    auto end = steady_clock::now();
+void
+Renderer::publish_frame(const std::atomic<bool> *tiles_done,
+                        std::vector<bool> &tiles_copied,
+                        std::vector<float> &frame)
+{
+    for (size_t i = 0; i < _tiles.size(); ++i) {
+        if (tiles_copied[i] || !tiles_done[i].load(std::memory_order_acquire))
+            continue;
+        const Tile &tile = _tiles[i];
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            size_t row = pixel_index(tile.x0, y);
+            std::copy(_buffer.begin() + row, _buffer.begin() + row + tile.width(),
+                      frame.begin() + row);
+        }
+        tiles_copied[i] = true;
+    }
+    // Only the canonical pixels are rendered before finish_render(), so
+    // mirror them. Pixels whose canonical pixel is not done yet stay black.
+    if (!_symmetry.empty()) {
+        for (int y = _window.y0; y < _window.y1; ++y) {
+            for (int x = _window.x0; x < _window.x1; ++x) {
+                int cx, cy;
+                _symmetry.canonical_pixel(x, y, cx, cy);
+                if (cx != x || cy != y)
+                    frame[pixel_index(x, y)] = frame[pixel_index(cx, cy)];
+            }
+        }
+    }
+    _publisher->publish(frame.data(), progress());
+}
 
-    auto elapsed = end - start;
-    auto hrs = duration_cast<hours>(elapsed);
-    auto mins = duration_cast<minutes>(elapsed - hrs);
-    auto secs = duration_cast<seconds>(elapsed - hrs - mins);
+float
+Renderer::progress() const
+{
+    return _tiles.empty() ? 1.0f : float(_tiles_done) / _tiles.size();
+}
 
-    std::cerr << " (";
-    if (hrs.count() != 0) std::cerr << hrs.count() << "h ";
-    if (mins.count() != 0) std::cerr << mins.count() << "m ";
-    std::cerr << secs.count() << "s)\n";
+void
+Renderer::render_directions(const vec3 *directions, size_t count,
+                            float *radiance)
+{
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, count),
+        [&](const tbb::blocked_range<size_t> &range) {
+            Sampler sampler(range.begin(), range.end(), _seed);
+            for (size_t i = range.begin(); i < range.end(); ++i) {
+                Ray ray(vec3(0.0f, 0.0f, _eye_altitude),
+                        normalize(directions[i]));
+                float accum = 0.0f;
+                for (int s = 0; s < _samples_per_pixel; ++s)
+                    accum += _scene->integrator->Li(_scene.get(), &sampler,
+                                                    ray, _wavelength);
+                radiance[i] = accum / _samples_per_pixel;
+            }
+        });
 }
 
 void
 Renderer::write(const std::string &filename)
 {
-    const char *err = nullptr;
-    int ret = SaveEXR(_buffer.data(), _image_width, _image_height, 1, 0,
-                      filename.c_str(), &err);
-    if (ret != TINYEXR_SUCCESS) {
-        std::cerr << "Failed to write EXR image: " << err << std::endl;
-        FreeEXRErrorMessage(err);
+    // Single channel images keep the "A" channel name that SaveEXR() used to
+    // give them, which existing readers expect.
+    save_image(filename, "EXR image", {{"A", _buffer.data()}});
+}
+
+void
+Renderer::set_pixels(std::vector<float> pixels, std::vector<float> variance)
+{
+    if (pixels.size() != _buffer.size())
+        throw std::runtime_error("The pixels do not match the render window");
+    _buffer = std::move(pixels);
+    if (_compute_variance)
+        _features.variance = std::move(variance);
+    if (_compute_features && !_features_computed)
+        compute_features();
+    if (_publisher)
+        _publisher->publish(_buffer.data(), 1.0f);
+}
+
+void
+Renderer::finish_render()
+{
+    if (!_symmetry.empty())
+        fill_symmetric_pixels();
+    if (_compute_features)
+        compute_features();
+}
+
+void
+Renderer::denoise()
+{
+    using namespace std::chrono;
+
+    TraceScope trace("denoise", "renderer");
+
+    if (_verbose)
+        std::cerr << "Denoising" << std::flush;
+    auto start = steady_clock::now();
+
+    Denoiser denoiser(_denoise_radius, _denoise_strength);
+    std::vector<float> output;
+    denoiser.denoise(_buffer, _features, _window.width(), _window.height(),
+                     output);
+    _noisy_buffer.swap(_buffer);
+    _buffer.swap(output);
+
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+    if (_verbose)
+        std::cerr << " (" << elapsed.count() / 1000.0f << "s)\n";
+}
+
+void
+Renderer::write_features(const std::string &filename)
+{
+    // The noisy image is saved along the features, so the denoiser can be
+    // tuned offline.
+    save_image(filename, "EXR image",
+               {{"Y", _noisy_buffer.empty() ? _buffer.data()
+                                            : _noisy_buffer.data()},
+                {"optical_depth", _features.optical_depth.data()},
+                {"variance", _features.variance.data()},
+                {"view_zenith", _features.view_zenith.data()}});
+}
+
+void
+Renderer::write_jacobian(const std::string &filename)
+{
+    // Solid angle subtended by each pixel, evaluated at the pixel center
+    std::vector<float> jacobian(size_t(_window.width()) * _window.height());
+    float pixel_area = _inv_image_size.x * _inv_image_size.y;
+    for (int y = _window.y0; y < _window.y1; ++y) {
+        for (int x = _window.x0; x < _window.x1; ++x) {
+            vec2 uv = (vec2(x, y) + 0.5f) * _inv_image_size;
+            jacobian[pixel_index(x, y)] =
+                _scene->camera->jacobian(uv) * pixel_area;
+        }
+    }
+    save_image(filename, "Jacobian EXR image", {{"A", jacobian.data()}});
+}
+
+void
+Renderer::write_cost(const std::string &filename)
+{
+    save_image(filename, "cost EXR image",
+               {{"null_collisions", _cost_null_collisions.data()},
+                {"path_length", _cost_path_length.data()},
+                {"time_us", _cost_time.data()}});
+}
+
+void
+Renderer::write_error_map(const std::string &filename)
+{
+    if (_error_map.empty()) {
+        std::cerr << "No error map available (adaptive sampling is disabled)\n";
         return;
     }
-    std::cerr << "Saved EXR image [ " << filename << " ]\n";
+    save_image(filename, "error map EXR image", {{"A", _error_map.data()}});
+}
+
+void
+Renderer::save_image(const std::string &filename, const char *description,
+                     const std::vector<std::pair<std::string, const float *>> &channels)
+{
+    TraceScope trace(description, "write");
+    ExrStats stats;
+    if (!save_exr_channels(filename, _window.width(), _window.height(),
+                           channels, _exr_options, &stats))
+        throw std::runtime_error("Could not write " + filename);
+    if (!_verbose)
+        return;
+    // Saved EXR image [ out.exr ] (52371 bytes, encoded in 0.012s, written
+    // in 0.001s)
+    std::cerr << "Saved " << description << " [ " << filename << " ] ("
+              << stats.bytes << " bytes, encoded in " << std::fixed
+              << std::setprecision(3) << stats.encode_seconds
+              << "s, written in " << stats.write_seconds << "s)\n"
+              << std::defaultfloat;
 }
 
 void
-Renderer::create_scene(const CommandLineArguments &args)
+Renderer::create_scene(const CommandLineArguments &args,
+                       const CameraView &view, const Scene *shared_scene)
 {
     float aspect_ratio = float(_image_width) / float(_image_height);
     _scene = std::make_unique<Scene>();
-    _scene->light = std::make_unique<Sun>(args.sun_elevation, args.sun_azimuth);
-    switch(args.atmospheric_model) {
-    case 0:
-        _scene->atmosphere = std::make_unique<GuimeraAtmosphere>(args.month,
-                                                                 args.turbidity,
-                                                                 args.aerosol_type);
-        break;
-    default:
-        throw std::runtime_error("Unknown atmospheric model");
+    // Reuse whatever components the shared scene provides
+    if (shared_scene && shared_scene->light) {
+        _scene->light = shared_scene->light;
+    } else {
+        _scene->light = std::make_shared<Sun>(args.sun_elevation, args.sun_azimuth);
     }
-    switch (args.camera) {
+    if (shared_scene && shared_scene->atmosphere) {
+        _scene->atmosphere = shared_scene->atmosphere;
+    } else {
+        switch(args.atmospheric_model) {
+        case 0:
+            _scene->atmosphere = std::make_shared<GuimeraAtmosphere>(
+                args.month, args.turbidity, args.aerosol_type);
+            break;
+        default:
+            throw std::runtime_error("Unknown atmospheric model");
+        }
+    }
+    if (shared_scene && shared_scene->integrator) {
+        _scene->integrator = shared_scene->integrator;
+    } else {
+        switch (args.integrator) {
+        case 0:
+            _scene->integrator = std::make_shared<PathTracingIntegrator>(
+                args.max_order, args.only_ms);
+            break;
+        case 1:
+            _scene->integrator = std::make_shared<TransmittanceIntegrator>();
+            break;
+        default:
+            throw std::runtime_error("Unknown integrator");
+        }
+    }
+    switch (view.camera) {
     case 0:
-        _scene->camera = std::make_unique<EquirectangularCamera>(args.eye_altitude);
+        _scene->camera = std::make_unique<EquirectangularCamera>(
+            view.eye_altitude, args.upper_hemisphere, args.horizon_exponent);
         break;
     case 1:
-        _scene->camera = std::make_unique<FisheyeCamera>(args.eye_altitude, aspect_ratio);
+        _scene->camera = std::make_unique<FisheyeCamera>(view.eye_altitude, aspect_ratio);
+        break;
+    case 2:
+        _scene->camera = std::make_unique<PerspectiveCamera>(
+            view.eye_altitude, view.view_elevation, view.view_azimuth,
+            view.fov, aspect_ratio);
         break;
     default:
         throw std::runtime_error("Unknown camera mode");
     }
-    switch (args.integrator) {
+    _scene->ground_albedo = args.albedo;
+}
+
+void
+Renderer::detect_symmetry(const CommandLineArguments &args,
+                          const CameraView &view)
+{
+    // The atmosphere is spherically symmetric and the ground is uniform, so the
+    // sky is mirror-symmetric about the vertical plane that contains the Sun.
+    // If the Sun is at the zenith or nadir, or if the integrator does not
+    // depend on the Sun at all, the sky is also invariant to rotations around
+    // the vertical axis.
+    bool azimuth_invariant = args.integrator == 1
+        || fabsf(fabsf(args.sun_elevation) - 90.0f) < 1e-4f;
+    // Sun azimuth in [0,360)
+    float azimuth = fmodf(args.sun_azimuth, 360.0f);
+    if (azimuth < 0.0f)
+        azimuth += 360.0f;
+    auto azimuth_is = [azimuth](float a) {
+        float d = fmodf(fabsf(azimuth - a), 180.0f);
+        return d < 1e-4f || d > 180.0f - 1e-4f;
+    };
+
+    const char *description = nullptr;
+    switch (view.camera) {
     case 0:
-        _scene->integrator = std::make_unique<PathTracingIntegrator>(
-            args.max_order, args.only_ms);
+        if (azimuth_invariant) {
+            _symmetry = ImageSymmetry(_image_width, _image_height);
+            _symmetry.set_row_invariant();
+            description = "azimuthal symmetry, one pixel per row";
+        } else {
+            // Azimuth phi is mirrored to 2*phi_sun - phi, so column x is
+            // mirrored to s - 1 - x. The pixel footprints only match if s is
+            // an integer.
+            float s = azimuth / 180.0f * _image_width;
+            if (fabsf(s - roundf(s)) < 1e-3f) {
+                _symmetry = ImageSymmetry(_image_width, _image_height,
+                                          int(roundf(s)) - 1);
+                _symmetry.add_map({false, true, false});
+                description = "mirror symmetry about the solar vertical plane";
+            }
+        }
         break;
-    case 1:
-        _scene->integrator = std::make_unique<TransmittanceIntegrator>();
+    case 1: {
+        _symmetry = ImageSymmetry(_image_width, _image_height,
+                                  _image_width - 1);
+        bool square = _image_width == _image_height;
+        if (azimuth_invariant) {
+            _symmetry.add_map({false, true, false});
+            _symmetry.add_map({false, false, true});
+            _symmetry.add_map({false, true, true});
+            if (square) {
+                // Full symmetry group of the square pixel grid
+                _symmetry.add_map({true, false, false});
+                _symmetry.add_map({true, true, false});
+                _symmetry.add_map({true, false, true});
+                _symmetry.add_map({true, true, true});
+            }
+            description = "azimuthal symmetry";
+        } else if (azimuth_is(0.0f)) {
+            _symmetry.add_map({false, false, true});
+        } else if (azimuth_is(90.0f)) {
+            _symmetry.add_map({false, true, false});
+        } else if (square && azimuth_is(45.0f)) {
+            _symmetry.add_map({true, false, false});
+        } else if (square && azimuth_is(135.0f)) {
+            _symmetry.add_map({true, true, true});
+        }
+        if (!description && !_symmetry.empty())
+            description = "mirror symmetry about the solar vertical plane";
         break;
+    }
     default:
-        throw std::runtime_error("Unknown integrator");
+        break;
     }
-    _scene->ground_albedo = args.albedo;
+
+    if (_symmetry.empty())
+        return;
+    _symmetry.set_window(_window.x0, _window.x1, _window.y0, _window.y1);
+
+    size_t unique_pixels = 0;
+    for (int y = _window.y0; y < _window.y1; ++y)
+        for (int x = _window.x0; x < _window.x1; ++x)
+            if (_symmetry.is_canonical(x, y))
+                ++unique_pixels;
+    if (_verbose)
+        std::cerr << "Using " << description << " (rendering " << unique_pixels
+              << " of " << _buffer.size() << " pixels)\n";
 }
 
 void
@@ -176,16 +584,17 @@ Renderer::prepare_tiles()
     if (!_tiles.empty())
         _tiles.clear();
 
-    int x_tiles = (_image_width  + _tile_width  - 1) / _tile_width;
-    int y_tiles = (_image_height + _tile_height - 1) / _tile_height;
+    // Only the pixels inside the window are traced
+    int x_tiles = (_window.width()  + _tile_width  - 1) / _tile_width;
+    int y_tiles = (_window.height() + _tile_height - 1) / _tile_height;
 
     for (int j = 0; j < y_tiles; ++j) {
         for (int i = 0; i < x_tiles; ++i) {
-            int x0 = i * _tile_width;
-            int x1 = (i == x_tiles - 1) ? _image_width : x0 + _tile_width;
+            int x0 = _window.x0 + i * _tile_width;
+            int x1 = (i == x_tiles - 1) ? _window.x1 : x0 + _tile_width;
 
-            int y0 = j * _tile_height;
-            int y1 = (j == y_tiles - 1) ? _image_height : y0 + _tile_height;
+            int y0 = _window.y0 + j * _tile_height;
+            int y1 = (j == y_tiles - 1) ? _window.y1 : y0 + _tile_height;
 
             _tiles.push_back(Tile(x0, x1, y0, y1));
         }
@@ -193,10 +602,25 @@ Renderer::prepare_tiles()
 }
 
 float
-Renderer::render_pixel(Sampler *sampler, int x, int y, float wl) const
+Renderer::render_pixel(Sampler *sampler, int x, int y, float wl,
+                       float *variance, PixelCost *cost) const
 {
+    using namespace std::chrono;
+
+    // The integrator counts its work in the counters of this thread
+    const RenderCounters &counters = thread_counters();
+    uint64_t null_collisions = counters.null_collisions;
+    uint64_t path_vertices = counters.path_vertices;
+    uint64_t camera_rays = counters.camera_rays;
+    auto start = cost ? steady_clock::now() : steady_clock::time_point();
+
+    bool record = path_recording_enabled.load(std::memory_order_relaxed);
+    uint64_t first_path =
+        (uint64_t(y) * _image_width + x) * uint64_t(_samples_per_pixel);
+
     vec2 pixel_coord{x, y};
     float accum = 0.0f;
+    float accum_sq = 0.0f;
     for (int i = 0; i < _samples_per_pixel; ++i) {
         // Get the normalized coordinates [0,1] of this sample
         vec2 uv = (pixel_coord + sampler->next_2d()) * _inv_image_size;
@@ -205,26 +629,357 @@ Renderer::render_pixel(Sampler *sampler, int x, int y, float wl) const
         if (!_scene->camera->sample_ray(ray, uv))
             continue;
         // Compute the incident radiance
-        accum += _scene->integrator->Li(_scene.get(), sampler, ray, wl);
+        if (record)
+            begin_path(x, y, i, first_path + i, wl);
+        float L = _scene->integrator->Li(_scene.get(), sampler, ray, wl);
+        if (record)
+            end_path(L);
+        accum += L;
+        accum_sq += L * L;
     }
     accum /= _samples_per_pixel;
+    if (variance) {
+        // Variance of the pixel estimate, i.e. the sample variance divided by
+        // the number of samples.
+        float n = _samples_per_pixel;
+        float sample_variance = n > 1.0f
+            ? fmaxf(0.0f, (accum_sq - n * accum * accum) / (n - 1.0f))
+            : 0.0f;
+        *variance = sample_variance / n;
+    }
+    if (cost) {
+        cost->microseconds =
+            duration<float, std::micro>(steady_clock::now() - start).count();
+        cost->null_collisions = counters.null_collisions - null_collisions;
+        uint64_t paths = counters.camera_rays - camera_rays;
+        cost->path_length = paths > 0
+            ? float(counters.path_vertices - path_vertices) / paths : 0.0f;
+    }
     return accum;
 }
 
 void
+Renderer::store_cost(size_t index, const PixelCost &cost)
+{
+    _cost_time[index] = cost.microseconds;
+    _cost_null_collisions[index] = cost.null_collisions;
+    _cost_path_length[index] = cost.path_length;
+}
+
+int64_t
 Renderer::render_tile(Sampler *sampler, const Tile &tile)
 {
+    TraceScope trace("tile", "renderer");
+    PerfScope perf;
+    int64_t pixels = 0;
+    bool symmetric = !_symmetry.empty();
     for (int y = tile.y0; y < tile.y1; ++y) {
         for (int x = tile.x0; x < tile.x1; ++x) {
-            float value = render_pixel(sampler, x, y, _wavelength);
+            // The remaining pixels are copied from their canonical pixel once
+            // every tile is done.
+            if (symmetric && !_symmetry.is_canonical(x, y))
+                continue;
+            ++pixels;
+            float *variance = _compute_variance
+                ? &_features.variance[pixel_index(x, y)] : nullptr;
+            PixelCost cost;
+            float value = render_pixel(sampler, x, y, _wavelength, variance,
+                                       _compute_cost ? &cost : nullptr);
             place_pixel(x, y, value);
+            if (_compute_cost)
+                store_cost(pixel_index(x, y), cost);
+        }
+    }
+    perf.stop();
+    trace.set_tile({tile.x0, tile.y0, tile.width(), tile.height(),
+                    pixels * _samples_per_pixel,
+                    perf.counters().values[PerfCounters::CYCLES],
+                    perf.counters().values[PerfCounters::INSTRUCTIONS]});
+    return pixels * _samples_per_pixel;
+}
+
+int64_t
+Renderer::stream_tile(Sampler *sampler, const Tile &tile,
+                      TiledExrWriter &writer) const
+{
+    TraceScope trace("tile", "renderer");
+    PerfScope perf;
+    std::vector<float> pixels(size_t(tile.width()) * tile.height());
+    std::vector<float> variance(pixels.size());
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            size_t i = size_t(y - tile.y0) * tile.width() + (x - tile.x0);
+            pixels[i] = render_pixel(sampler, x, y, _wavelength, &variance[i]);
         }
     }
+    perf.stop();
+    trace.set_tile({tile.x0, tile.y0, tile.width(), tile.height(),
+                    int64_t(tile.width()) * tile.height() * _samples_per_pixel,
+                    perf.counters().values[PerfCounters::CYCLES],
+                    perf.counters().values[PerfCounters::INSTRUCTIONS]});
+    // The tiles start at the window origin, like the EXR tiles
+    writer.write_tile((tile.x0 - _window.x0) / _tile_width,
+                      (tile.y0 - _window.y0) / _tile_height,
+                      {pixels.data(), variance.data()});
+    return int64_t(pixels.size()) * _samples_per_pixel;
 }
 
 void
 Renderer::place_pixel(int x, int y, float value)
 {
-    size_t pixel_index = y * _image_width + x;
-    _buffer[pixel_index] = value;
+    _buffer[pixel_index(x, y)] = value;
+}
+
+void
+Renderer::fill_symmetric_pixels()
+{
+    tbb::parallel_for(_window.y0, _window.y1, [&](int y) {
+        for (int x = _window.x0; x < _window.x1; ++x) {
+            int cx, cy;
+            _symmetry.canonical_pixel(x, y, cx, cy);
+            if (cx == x && cy == y)
+                continue;
+            _buffer[pixel_index(x, y)] = _buffer[pixel_index(cx, cy)];
+            if (_compute_variance) {
+                _features.variance[pixel_index(x, y)] =
+                    _features.variance[pixel_index(cx, cy)];
+            }
+            if (_compute_cost) {
+                _cost_time[pixel_index(x, y)] = _cost_time[pixel_index(cx, cy)];
+                _cost_null_collisions[pixel_index(x, y)] =
+                    _cost_null_collisions[pixel_index(cx, cy)];
+                _cost_path_length[pixel_index(x, y)] =
+                    _cost_path_length[pixel_index(cx, cy)];
+            }
+        }
+    });
+}
+
+void
+Renderer::render_adaptive()
+{
+    TraceScope trace("adaptive", "renderer");
+    // Cells of the quadtree. Unlike tiles, the bounds are inclusive: the four
+    // corners of a cell are pixels that have already been rendered.
+    struct Cell {
+        int x0, x1, y0, y1;
+    };
+    struct Point {
+        int x, y;
+    };
+
+    // Split an inclusive interval at its midpoint, if it has one
+    auto split = [](int a, int b, int *c) {
+        c[0] = a;
+        if (b - a >= 2) {
+            c[1] = (a + b) / 2;
+            c[2] = b;
+            return 3;
+        }
+        c[1] = b;
+        return a == b ? 1 : 2;
+    };
+
+    std::vector<uint8_t> rendered(_buffer.size(), 0);
+    std::vector<float> variance(_buffer.size(), 0.0f);
+    _error_map.assign(_buffer.size(), 0.0f);
+    size_t traced = 0;
+    uint64_t sampler_offset = 0;
+
+    // Trace all the given pixels that have not been rendered yet
+    auto render_points = [&](const std::vector<Point> &candidates) {
+        std::vector<Point> points;
+        for (const Point &p : candidates) {
+            size_t i = pixel_index(p.x, p.y);
+            if (!rendered[i]) {
+                rendered[i] = 1;
+                points.push_back(p);
+            }
+        }
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, points.size()),
+            [&](const tbb::blocked_range<size_t> &range) {
+                PerfScope perf;
+                Sampler sampler(sampler_offset + range.begin(),
+                                sampler_offset + range.end(), _seed);
+                for (size_t i = range.begin(); i < range.end(); ++i) {
+                    size_t index = pixel_index(points[i].x, points[i].y);
+                    PixelCost cost;
+                    _buffer[index] = render_pixel(&sampler, points[i].x,
+                                                  points[i].y, _wavelength,
+                                                  &variance[index],
+                                                  _compute_cost ? &cost : nullptr);
+                    if (_compute_cost)
+                        store_cost(index, cost);
+                }
+            });
+        sampler_offset += points.size();
+        traced += points.size();
+    };
+
+    // Coarse grid. The last row and column are always part of it.
+    std::vector<int> grid_x, grid_y;
+    for (int x = _window.x0; x < _window.x1 - 1; x += _adaptive_step)
+        grid_x.push_back(x);
+    grid_x.push_back(_window.x1 - 1);
+    for (int y = _window.y0; y < _window.y1 - 1; y += _adaptive_step)
+        grid_y.push_back(y);
+    grid_y.push_back(_window.y1 - 1);
+
+    std::vector<Point> points;
+    for (int y : grid_y)
+        for (int x : grid_x)
+            points.push_back({x, y});
+    render_points(points);
+
+    std::vector<Cell> cells;
+    for (size_t j = 0; j < std::max<size_t>(1, grid_y.size() - 1); ++j) {
+        for (size_t i = 0; i < std::max<size_t>(1, grid_x.size() - 1); ++i) {
+            cells.push_back({grid_x[i], grid_x[std::min(i + 1, grid_x.size() - 1)],
+                             grid_y[j], grid_y[std::min(j + 1, grid_y.size() - 1)]});
+        }
+    }
+
+    // Leaves of the quadtree, from coarse to fine
+    std::vector<std::pair<Cell, float>> leaves;
+
+    int level = 0;
+    while (!cells.empty()) {
+        if (_cancel_requested)
+            break;
+        if (_verbose)
+            std::cerr << "\rAdaptive sampling, level " << level << ": "
+                      << traced << " pixels traced" << std::flush;
+
+        // Render the center and edge midpoints of every cell
+        points.clear();
+        for (const Cell &cell : cells) {
+            int xs[3], ys[3];
+            int nx = split(cell.x0, cell.x1, xs);
+            int ny = split(cell.y0, cell.y1, ys);
+            for (int j = 0; j < ny; ++j)
+                for (int i = 0; i < nx; ++i)
+                    points.push_back({xs[i], ys[j]});
+        }
+        render_points(points);
+
+        // Compare the new points against the bilinear interpolation of the
+        // corners. Differences that can be explained by the Monte Carlo noise
+        // of the points are ignored.
+        std::vector<float> cell_error(cells.size());
+        tbb::parallel_for(size_t(0), cells.size(), [&](size_t c) {
+            const Cell &cell = cells[c];
+            float c00 = _buffer[pixel_index(cell.x0, cell.y0)];
+            float c10 = _buffer[pixel_index(cell.x1, cell.y0)];
+            float c01 = _buffer[pixel_index(cell.x0, cell.y1)];
+            float c11 = _buffer[pixel_index(cell.x1, cell.y1)];
+            int xs[3], ys[3];
+            int nx = split(cell.x0, cell.x1, xs);
+            int ny = split(cell.y0, cell.y1, ys);
+            float max_error = 0.0f;
+            for (int j = 0; j < ny; ++j) {
+                for (int i = 0; i < nx; ++i) {
+                    float tx = cell.x1 > cell.x0
+                        ? float(xs[i] - cell.x0) / (cell.x1 - cell.x0) : 0.0f;
+                    float ty = cell.y1 > cell.y0
+                        ? float(ys[j] - cell.y0) / (cell.y1 - cell.y0) : 0.0f;
+                    float interp = mix(mix(c00, c10, tx), mix(c01, c11, tx), ty);
+                    size_t index = pixel_index(xs[i], ys[j]);
+                    float error = fabsf(_buffer[index] - interp)
+                        - 2.0f * sqrtf(variance[index]);
+                    max_error = fmaxf(max_error, error);
+                }
+            }
+            cell_error[c] = max_error;
+        });
+
+        std::vector<Cell> next_cells;
+        for (size_t c = 0; c < cells.size(); ++c) {
+            const Cell &cell = cells[c];
+            int xs[3], ys[3];
+            int nx = split(cell.x0, cell.x1, xs);
+            int ny = split(cell.y0, cell.y1, ys);
+            // Every pixel of the cell has been rendered
+            if (cell.x1 - cell.x0 <= 2 && cell.y1 - cell.y0 <= 2)
+                continue;
+            float scale = 0.25f * (fabsf(_buffer[pixel_index(cell.x0, cell.y0)]) +
+                                   fabsf(_buffer[pixel_index(cell.x1, cell.y0)]) +
+                                   fabsf(_buffer[pixel_index(cell.x0, cell.y1)]) +
+                                   fabsf(_buffer[pixel_index(cell.x1, cell.y1)]));
+            bool refine = cell_error[c] > _adaptive_threshold * scale;
+            for (int j = 0; j < std::max(1, ny - 1); ++j) {
+                for (int i = 0; i < std::max(1, nx - 1); ++i) {
+                    Cell child = {xs[i], xs[std::min(i + 1, nx - 1)],
+                                  ys[j], ys[std::min(j + 1, ny - 1)]};
+                    if (refine)
+                        next_cells.push_back(child);
+                    else
+                        leaves.push_back({child, cell_error[c]});
+                }
+            }
+        }
+        cells.swap(next_cells);
+        ++level;
+    }
+
+    // Reconstruct the remaining pixels. Finer leaves are processed last, so
+    // they take precedence on the edges they share with coarser leaves.
+    for (const auto &[cell, error] : leaves) {
+        float c00 = _buffer[pixel_index(cell.x0, cell.y0)];
+        float c10 = _buffer[pixel_index(cell.x1, cell.y0)];
+        float c01 = _buffer[pixel_index(cell.x0, cell.y1)];
+        float c11 = _buffer[pixel_index(cell.x1, cell.y1)];
+        for (int y = cell.y0; y <= cell.y1; ++y) {
+            for (int x = cell.x0; x <= cell.x1; ++x) {
+                size_t index = pixel_index(x, y);
+                if (rendered[index])
+                    continue;
+                float tx = cell.x1 > cell.x0
+                    ? float(x - cell.x0) / (cell.x1 - cell.x0) : 0.0f;
+                float ty = cell.y1 > cell.y0
+                    ? float(y - cell.y0) / (cell.y1 - cell.y0) : 0.0f;
+                _buffer[index] = mix(mix(c00, c10, tx), mix(c01, c11, tx), ty);
+                _error_map[index] = error;
+            }
+        }
+    }
+    // The error of the rendered pixels is their Monte Carlo standard error
+    for (size_t i = 0; i < _buffer.size(); ++i) {
+        if (rendered[i])
+            _error_map[i] = sqrtf(variance[i]);
+    }
+    if (_compute_variance) {
+        // Treat the interpolation error as noise
+        for (size_t i = 0; i < _buffer.size(); ++i)
+            _features.variance[i] = _error_map[i] * _error_map[i];
+    }
+
+    if (_verbose)
+        std::cerr << "\rAdaptive sampling, " << level << " levels: " << traced
+              << " of " << _buffer.size() << " pixels traced ("
+              << std::setprecision(3) << 100.0f * traced / _buffer.size()
+              << "%)";
+}
+
+void
+Renderer::compute_features()
+{
+    // The variance is filled while rendering. The remaining features only
+    // depend on the ray through the pixel center.
+    _features_computed = true;
+    tbb::parallel_for(_window.y0, _window.y1, [&](int y) {
+        for (int x = _window.x0; x < _window.x1; ++x) {
+            size_t index = pixel_index(x, y);
+            vec2 uv = (vec2(x, y) + 0.5f) * _inv_image_size;
+            Ray ray;
+            if (!_scene->camera->sample_ray(ray, uv)) {
+                _features.view_zenith[index] = 0.0f;
+                _features.optical_depth[index] = 0.0f;
+                continue;
+            }
+            _features.view_zenith[index] = acosf(clamp(ray.d.z, -1.0f, 1.0f));
+            _features.optical_depth[index] =
+                optical_depth(_scene.get(), ray, _wavelength);
+        }
+    });
 }
@@ -22,43 +22,183 @@
 #ifndef RENDERER_HXX
 #define RENDERER_HXX
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "denoiser.hxx"
+#include "exr.hxx"
+#include "frames.hxx"
+#include "progress.hxx"
 #include "scene.hxx"
+#include "symmetry.hxx"
 
 class CommandLineArguments;
 class Sampler;
+class TiledExrWriter;
+struct CameraView;
 
 class Renderer final {
 public:
     struct Tile {
         Tile(int x0_, int x1_, int y0_, int y1_)
             : x0(x0_), x1(x1_), y0(y0_), y1(y1_) {}
+        int width() const { return x1 - x0; }
+        int height() const { return y1 - y0; }
         int x0, x1, y0, y1;
     };
 
     Renderer(const CommandLineArguments &args);
+    /**
+     * Render the given view instead of the main one. If shared_scene is not
+     * null, the atmosphere, integrator and light source it contains (if any)
+     * are reused instead of creating new ones.
+     */
+    Renderer(const CommandLineArguments &args, const CameraView &view,
+             const Scene *shared_scene);
 
     void render();
+    /**
+     * Ask the running render() to stop early, or the next one to stop as
+     * soon as it starts if none is running. Can be called from any thread.
+     */
+    void cancel() { _cancel_requested = true; }
+    // Withdraw a cancel() that no render() has honoured yet
+    void clear_cancel() { _cancel_requested = false; }
+    // Whether the last render() was cancelled
+    bool cancelled() const { return _cancelled; }
+    // Fraction of the tiles of the current render() that are done
+    float progress() const;
+    /**
+     * Estimate the radiance seen from the camera position in each of the given
+     * world space directions, with the same number of samples as the pixels.
+     */
+    void render_directions(const glm::vec3 *directions, size_t count,
+                           float *radiance);
+    void denoise();
+    // The writers throw std::runtime_error if the file cannot be saved
     void write(const std::string &filename);
+    void write_jacobian(const std::string &filename);
+    void write_error_map(const std::string &filename);
+    void write_features(const std::string &filename);
+    void write_cost(const std::string &filename);
+
+    // Building blocks of render(), so that the tiles of several renderers can
+    // be scheduled together. finish_render() must be called once all the
+    // tiles are done.
+    const std::vector<Tile> &tiles() const { return _tiles; }
+    // Returns the number of samples traced
+    int64_t render_tile(Sampler *sampler, const Tile &tile);
+    bool is_streaming() const { return !_stream_filename.empty(); }
+    void finish_render();
+    bool is_adaptive() const { return _adaptive_step > 0; }
+    const Scene *scene() const { return _scene.get(); }
+    // Pixels of the rendered window, row by row
+    const std::vector<float> &buffer() const { return _buffer; }
+    /**
+     * Move the pixels out of the renderer. Only render() may be called
+     * afterwards, and it allocates a new framebuffer.
+     */
+    std::vector<float> take_buffer() { return std::move(_buffer); }
+    // Region of the image that is rendered
+    const Tile &window() const { return _window; }
+    // Variance of every pixel estimate. Only available if denoising, writing
+    // features or caching.
+    const std::vector<float> &variance() const { return _features.variance; }
+    /**
+     * Replace the rendered image, e.g. with a cached one. variance must have
+     * the same size as the pixels.
+     */
+    void set_pixels(std::vector<float> pixels, std::vector<float> variance);
+    int samples_per_pixel() const { return _samples_per_pixel; }
+    void set_samples_per_pixel(int samples) { _samples_per_pixel = samples; }
+    void set_seed(uint64_t seed) { _seed = seed; }
+    float wavelength() const { return _wavelength; }
+    void set_wavelength(float wavelength) { _wavelength = wavelength; }
 private:
-    void create_scene(const CommandLineArguments &args);
+    // Work spent on a pixel
+    struct PixelCost {
+        float microseconds;
+        float null_collisions;
+        float path_length;
+    };
+
+    void create_scene(const CommandLineArguments &args,
+                      const CameraView &view, const Scene *shared_scene);
+    void detect_symmetry(const CommandLineArguments &args,
+                         const CameraView &view);
     void prepare_tiles();
-    float render_pixel(Sampler *sampler, int x, int y, float wl) const;
-    void render_tile(Sampler *sampler, const Tile &tile);
+    float render_pixel(Sampler *sampler, int x, int y, float wl,
+                       float *variance = nullptr,
+                       PixelCost *cost = nullptr) const;
+    void store_cost(size_t index, const PixelCost &cost);
+    void render_adaptive();
+    int64_t stream_tile(Sampler *sampler, const Tile &tile,
+                        TiledExrWriter &writer) const;
     void place_pixel(int x, int y, float value);
+    void fill_symmetric_pixels();
+    void compute_features();
+    void publish_frame(const std::atomic<bool> *tiles_done,
+                       std::vector<bool> &tiles_copied,
+                       std::vector<float> &frame);
+    void save_image(const std::string &filename, const char *description,
+                    const std::vector<std::pair<std::string, const float *>> &channels);
+    size_t pixel_index(int x, int y) const {
+        return size_t(y - _window.y0) * _window.width() + (x - _window.x0);
+    }
 
     int _image_width, _image_height;
     int _tile_width,  _tile_height;
     float _wavelength;
     int _samples_per_pixel;
+    int _adaptive_step;
+    float _adaptive_threshold;
+    bool _compute_features;
+    bool _compute_variance;
+    bool _compute_cost;
+    uint64_t _seed = 0;
+    int _denoise_radius;
+    float _denoise_strength;
     glm::vec2 _inv_image_size;
+    float _eye_altitude;
+    bool _verbose;
+    ProgressReporter::Format _progress_format;
+    float _progress_interval;
+    // Prometheus textfile written while rendering, labelled with the output
+    // filename
+    std::string _metrics_filename;
+    float _metrics_interval;
+    std::string _output_filename;
+    ExrOptions _exr_options;
+    std::atomic<bool> _cancel_requested{false};
+    std::atomic<bool> _cancelled{false};
+    std::atomic<size_t> _tiles_done{0};
 
+    // Region of the image that is rendered and stored in the framebuffer
+    Tile _window;
+    // If not empty, tiles are written to this file as soon as they are done
+    // and the framebuffer is not allocated.
+    std::string _stream_filename;
     std::vector<float> _buffer;
+    // Receives a copy of the framebuffer every _publish_interval seconds
+    std::unique_ptr<FramePublisher> _publisher;
+    float _publish_interval;
+    // Estimated absolute error of every pixel when using adaptive sampling
+    std::vector<float> _error_map;
+    FeatureBuffers _features;
+    bool _features_computed = false;
+    // Time in microseconds, null collisions and mean path length (in
+    // vertices) of every pixel
+    std::vector<float> _cost_time, _cost_null_collisions, _cost_path_length;
+    // Image before denoising
+    std::vector<float> _noisy_buffer;
 
     std::vector<Tile> _tiles;
 
+    ImageSymmetry _symmetry;
+
     std::unique_ptr<Scene> _scene;
 };
 
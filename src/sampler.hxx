@@ -29,8 +29,12 @@
 
 class Sampler {
 public:
-    Sampler(uint64_t begin, uint64_t end) {
-        _random.seed(begin, end);
+    /**
+     * Renders with different seeds use different random sequences, so their
+     * results can be averaged.
+     */
+    Sampler(uint64_t begin, uint64_t end, uint64_t seed = 0) {
+        _random.seed(begin + (seed << 32), end);
     }
 
     float next_1d() {
@@ -27,11 +27,13 @@
 #include "integrator.hxx"
 #include "lightsource.hxx"
 
+// The atmosphere, integrator and light source can be shared between the
+// scenes of several views.
 struct Scene {
-    std::unique_ptr<Atmosphere> atmosphere;
+    std::shared_ptr<Atmosphere> atmosphere;
     std::unique_ptr<Camera> camera;
-    std::unique_ptr<Integrator> integrator;
-    std::unique_ptr<LightSource> light;
+    std::shared_ptr<Integrator> integrator;
+    std::shared_ptr<LightSource> light;
     float ground_albedo;
 };
 
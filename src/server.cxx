@@ -0,0 +1,308 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "server.hxx"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "args.hxx"
+#include "cache.hxx"
+#include "json.hxx"
+#include "renderer.hxx"
+
+// Longest accepted request line
+static const size_t MAX_REQUEST_SIZE = 1 << 20;
+// Connections served at the same time. Further clients are refused.
+static const int MAX_CONNECTIONS = 64;
+// Time allowed to receive a request or to send a reply
+static const int SOCKET_TIMEOUT_SECONDS = 30;
+
+RenderServer::RenderServer(const CommandLineArguments &args) :
+    _args(args)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (args.socket_path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path too long: " + args.socket_path);
+    strcpy(address.sun_path, args.socket_path.c_str());
+
+    _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listen_fd < 0)
+        throw std::runtime_error("Could not create socket: "
+                                 + std::string(strerror(errno)));
+    // Remove the socket left over by a previous server, but never another
+    // kind of file or the socket of a server that is still running
+    struct stat status;
+    if (lstat(args.socket_path.c_str(), &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            close(_listen_fd);
+            throw std::runtime_error("Could not listen on " + args.socket_path
+                                     + ": not a socket");
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool stale = probe >= 0
+            && connect(probe, (sockaddr *)&address, sizeof(address)) < 0
+            && errno == ECONNREFUSED;
+        if (probe >= 0)
+            close(probe);
+        if (!stale) {
+            close(_listen_fd);
+            throw std::runtime_error("Could not listen on " + args.socket_path
+                                     + ": already in use");
+        }
+        unlink(args.socket_path.c_str());
+    }
+    if (bind(_listen_fd, (sockaddr *)&address, sizeof(address)) < 0
+        || listen(_listen_fd, 64) < 0
+        || lstat(args.socket_path.c_str(), &status) < 0) {
+        std::string error = strerror(errno);
+        close(_listen_fd);
+        throw std::runtime_error("Could not listen on " + args.socket_path
+                                 + ": " + error);
+    }
+    _socket_device = status.st_dev;
+    _socket_inode = status.st_ino;
+}
+
+RenderServer::~RenderServer()
+{
+    close(_listen_fd);
+    // Another server may have replaced a socket that was removed by hand
+    struct stat status;
+    if (lstat(_args.socket_path.c_str(), &status) == 0
+        && status.st_dev == _socket_device && status.st_ino == _socket_inode)
+        unlink(_args.socket_path.c_str());
+}
+
+void
+RenderServer::run()
+{
+    std::cerr << "Listening on " << _args.socket_path << std::endl;
+
+    std::thread renderer(&RenderServer::render_requests, this);
+    while (true) {
+        int fd = accept(_listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            // The listening socket is shut down by stop()
+            break;
+        }
+        // Clients that stall must not hold a connection forever
+        timeval timeout = {SOCKET_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        bool refused;
+        {
+            std::scoped_lock lock(_mutex);
+            refused = _connections >= MAX_CONNECTIONS;
+            if (!refused) {
+                ++_connections;
+                _reading.insert(fd);
+                if (_stopping)
+                    shutdown(fd, SHUT_RD);
+                std::thread(&RenderServer::handle_connection, this, fd)
+                    .detach();
+            }
+        }
+        if (refused) {
+            std::string reply = "{\"status\": \"error\", \"message\": "
+                "\"Too many connections\"}\n";
+            send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+            close(fd);
+        }
+    }
+    stop();
+    renderer.join();
+
+    // Wait for the replies of the last requests to be sent
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [this] { return _connections == 0; });
+    std::cerr << "Server stopped" << std::endl;
+}
+
+void
+RenderServer::stop()
+{
+    std::scoped_lock lock(_mutex);
+    if (!_stopping) {
+        _stopping = true;
+        shutdown(_listen_fd, SHUT_RDWR);
+        // Stop waiting for the requests of idle connections
+        for (int fd : _reading)
+            shutdown(fd, SHUT_RD);
+    }
+    _cv.notify_all();
+}
+
+void
+RenderServer::handle_connection(int fd)
+{
+    std::string line;
+    char buffer[4096];
+    bool timed_out = false;
+    while (line.find('\n') == std::string::npos
+           && line.size() < MAX_REQUEST_SIZE) {
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            timed_out = true;
+        if (count <= 0)
+            break;
+        line.append(buffer, count);
+    }
+    bool stopped;
+    {
+        std::scoped_lock lock(_mutex);
+        _reading.erase(fd);
+        stopped = _stopping && line.find('\n') == std::string::npos;
+    }
+    line = line.substr(0, line.find('\n'));
+
+    std::string reply;
+    if (timed_out)
+        reply = "{\"status\": \"error\", \"message\": \"Timed out waiting "
+            "for the request\"}\n";
+    else if (stopped)
+        reply = "{\"status\": \"error\", \"message\": \"The server is "
+            "shutting down\"}\n";
+    else
+        reply = handle_request(line) + "\n";
+    size_t sent = 0;
+    while (sent < reply.size()) {
+        ssize_t count = send(fd, reply.data() + sent, reply.size() - sent,
+                             MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        sent += count;
+    }
+    close(fd);
+
+    std::scoped_lock lock(_mutex);
+    --_connections;
+    _cv.notify_all();
+}
+
+std::string
+RenderServer::handle_request(const std::string &line)
+{
+    using namespace std::chrono;
+
+    std::shared_ptr<Request> request;
+    std::future<std::string> result;
+    auto start = steady_clock::now();
+    try {
+        JsonValue message = JsonValue::parse(line);
+        if (!message.is_object())
+            throw std::runtime_error("The request must be a JSON object");
+        if (const JsonValue *command = message.find("command")) {
+            if (command->as_string() != "shutdown")
+                throw std::runtime_error("Unknown command '"
+                                         + command->as_string() + "'");
+            stop();
+            return "{\"status\": \"ok\"}";
+        }
+        const JsonValue *job = message.find("job");
+        if (!job)
+            throw std::runtime_error("The request has no job");
+
+        request = std::make_shared<Request>();
+        const JsonValue *priority = message.find("priority");
+        request->priority = priority ? (int)priority->as_number() : 0;
+        request->args = parse_job(*job, _args);
+        result = request->result.get_future();
+
+        std::scoped_lock lock(_mutex);
+        if (_stopping)
+            throw std::runtime_error("The server is shutting down");
+        request->sequence = _next_sequence++;
+        _queue.push(request);
+        _cv.notify_all();
+    } catch (const std::exception &e) {
+        return "{\"status\": \"error\", \"message\": " + json_quote(e.what())
+            + "}";
+    }
+
+    std::string error = result.get();
+    if (!error.empty())
+        return "{\"status\": \"error\", \"message\": " + json_quote(error)
+            + "}";
+    std::ostringstream reply;
+    reply << "{\"status\": \"ok\", \"output\": "
+          << json_quote(request->args->filename) << ", \"seconds\": "
+          << duration<double>(steady_clock::now() - start).count() << "}";
+    return reply.str();
+}
+
+void
+RenderServer::render_requests()
+{
+    while (true) {
+        std::shared_ptr<Request> request;
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [this] { return !_queue.empty() || _stopping; });
+            if (_queue.empty())
+                return;
+            request = _queue.top();
+            _queue.pop();
+        }
+
+        const CommandLineArguments &args = *request->args;
+        std::string error;
+        try {
+            Scene shared;
+            shared.atmosphere = _atmospheres.get(args);
+            Renderer renderer(args, args.main_view(), &shared);
+            render_cached(renderer, args);
+            if (args.denoise)
+                renderer.denoise();
+            if (!renderer.is_streaming())
+                renderer.write(args.filename);
+            if (!args.jacobian_filename.empty())
+                renderer.write_jacobian(args.jacobian_filename);
+            if (!args.error_map_filename.empty())
+                renderer.write_error_map(args.error_map_filename);
+            if (!args.features_filename.empty())
+                renderer.write_features(args.features_filename);
+            if (!args.cost_filename.empty())
+                renderer.write_cost(args.cost_filename);
+        } catch (const std::exception &e) {
+            error = e.what();
+        }
+        request->result.set_value(error);
+    }
+}
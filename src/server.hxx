@@ -0,0 +1,108 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SERVER_HXX
+#define SERVER_HXX
+
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "jobs.hxx"
+
+class CommandLineArguments;
+
+/**
+ * Render server listening on a Unix domain socket (--serve), which avoids
+ * paying the process startup and the atmosphere construction for every small
+ * render. Each connection sends one request as a single line of JSON:
+ *
+ *   {"priority": 1, "job": {"elevation": 30, "output": "/tmp/sky.exr"}}
+ *
+ * where "job" follows the --jobs format and the options given on the server
+ * command line apply to every job. The server renders the image to the job
+ * output and replies with one line:
+ *
+ *   {"status": "ok", "output": "/tmp/sky.exr", "seconds": 0.42}
+ *
+ * or {"status": "error", "message": "..."}. Requests are rendered one at a
+ * time, as each render already uses every core, highest priority first and in
+ * arrival order for equal priorities. {"command": "shutdown"} stops the server
+ * once the pending requests are done; connections that have not sent their
+ * request yet are dropped. Requests must arrive within 30 seconds, and at most
+ * 64 connections are served at the same time.
+ */
+class RenderServer final {
+public:
+    RenderServer(const CommandLineArguments &args);
+    ~RenderServer();
+
+    void run();
+private:
+    struct Request {
+        int priority;
+        uint64_t sequence;
+        std::unique_ptr<CommandLineArguments> args;
+        // Empty on success, the error message otherwise
+        std::promise<std::string> result;
+    };
+    struct RequestOrder {
+        bool operator()(const std::shared_ptr<Request> &a,
+                        const std::shared_ptr<Request> &b) const {
+            if (a->priority != b->priority)
+                return a->priority < b->priority;
+            return a->sequence > b->sequence;
+        }
+    };
+
+    void handle_connection(int fd);
+    std::string handle_request(const std::string &line);
+    void render_requests();
+    void stop();
+
+    const CommandLineArguments &_args;
+    AtmosphereCache _atmospheres;
+    int _listen_fd = -1;
+    // Identity of the bound socket file, so that only this server removes it
+    dev_t _socket_device = 0;
+    ino_t _socket_inode = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::priority_queue<std::shared_ptr<Request>,
+                        std::vector<std::shared_ptr<Request>>,
+                        RequestOrder> _queue;
+    uint64_t _next_sequence = 0;
+    int _connections = 0;
+    // Connections still receiving their request
+    std::set<int> _reading;
+    bool _stopping = false;
+};
+
+#endif // SERVER_HXX
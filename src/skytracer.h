@@ -0,0 +1,129 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SKYTRACER_H
+#define SKYTRACER_H
+
+/*
+ * C API of libskytracer, to embed the renderer in other programs. All the
+ * functions are thread-safe, but a scene must not be rendered from several
+ * threads at the same time.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented whenever the API or skytracer_params change */
+#define SKYTRACER_API_VERSION 2
+
+#define SKYTRACER_OK 0
+#define SKYTRACER_ERROR -1
+#define SKYTRACER_CANCELLED -2
+
+typedef struct skytracer_params {
+    /*
+     * sizeof(skytracer_params), set by skytracer_params_init(). Fields are
+     * only ever added at the end, and the fields missing from a smaller
+     * struct of an older caller keep their defaults.
+     */
+    size_t struct_size;
+    /* Image size in pixels */
+    int width;
+    int height;
+    int samples;
+    /* Wavelength in nanometers */
+    float wavelength;
+    /* 0=path tracing, 1=transmittance */
+    int integrator;
+    int max_order;
+    int only_ms;
+    /* 0=equirectangular, 1=fisheye, 2=perspective */
+    int camera;
+    int upper_hemisphere;
+    float horizon_exponent;
+    float view_elevation;
+    float view_azimuth;
+    float fov;
+    /* Altitude of the camera above sea level in meters */
+    float eye_altitude;
+    /* 0=Guimera */
+    int atmospheric_model;
+    const char *aerosol_type;
+    float turbidity;
+    /* 0 to 11 */
+    int month;
+    float albedo;
+    /* Sun position in degrees */
+    float sun_elevation;
+    float sun_azimuth;
+} skytracer_params;
+
+typedef struct skytracer_scene skytracer_scene;
+
+int skytracer_api_version(void);
+
+/*
+ * Fill the parameters with the defaults of the skytracer executable. Must be
+ * called before setting any parameter.
+ */
+void skytracer_params_init(skytracer_params *params);
+
+/*
+ * Create a scene from the parameters, or return NULL on error (see
+ * skytracer_last_error()).
+ */
+skytracer_scene *skytracer_scene_create(const skytracer_params *params);
+void skytracer_scene_destroy(skytracer_scene *scene);
+
+/*
+ * Render the image into buffer, which must hold width * height floats stored
+ * row by row. Returns SKYTRACER_OK, SKYTRACER_ERROR or SKYTRACER_CANCELLED.
+ */
+int skytracer_render(skytracer_scene *scene, float *buffer);
+
+/*
+ * Estimate the radiance seen from the camera position in count directions,
+ * given as x, y, z triples (z is up, the Sun azimuth is measured from x
+ * towards y).
+ */
+int skytracer_render_directions(skytracer_scene *scene, const float *directions,
+                                size_t count, float *radiance);
+
+/*
+ * Stop the current skytracer_render() of the scene, or the next one if none
+ * is running, from any thread
+ */
+void skytracer_cancel(skytracer_scene *scene);
+
+/* Fraction in [0,1] of the current or last render that is done */
+float skytracer_progress(const skytracer_scene *scene);
+
+/* Message of the last error of the calling thread */
+const char *skytracer_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SKYTRACER_H */
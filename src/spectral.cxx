@@ -0,0 +1,250 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "spectral.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "args.hxx"
+#include "exr.hxx"
+#include "progress.hxx"
+#include "renderer.hxx"
+
+namespace {
+
+std::string
+coefficient_name(int k)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "c%02d", k);
+    return name;
+}
+
+} // anonymous namespace
+
+SpectralBasis::SpectralBasis(float min_wavelength, float max_wavelength,
+                             int samples, int coefficients) :
+    _min_wavelength(min_wavelength),
+    _max_wavelength(max_wavelength),
+    _samples(samples),
+    _coefficients(coefficients)
+{
+    if (samples < 1 || coefficients < 1 || coefficients > samples)
+        throw std::runtime_error("The spectral basis needs between 1 and "
+                                 "--spectral-samples coefficients");
+    if (min_wavelength >= max_wavelength)
+        throw std::runtime_error("The spectral range must not be empty");
+
+    // Stieltjes procedure: build the recurrence from the polynomials
+    // evaluated at the sample positions, orthonormalizing one degree at a time
+    std::vector<double> x(samples), p(samples, 1.0 / std::sqrt(samples));
+    std::vector<double> p_prev(samples, 0.0), p_next(samples);
+    for (int i = 0; i < samples; ++i)
+        x[i] = position(wavelength(i));
+    _beta.push_back(std::sqrt(samples));
+    for (int k = 0; k < coefficients; ++k) {
+        double alpha = 0.0;
+        for (int i = 0; i < samples; ++i)
+            alpha += x[i] * p[i] * p[i];
+        double norm = 0.0;
+        for (int i = 0; i < samples; ++i) {
+            p_next[i] = (x[i] - alpha) * p[i] - _beta[k] * p_prev[i];
+            norm += p_next[i] * p_next[i];
+        }
+        norm = std::sqrt(norm);
+        _alpha.push_back(alpha);
+        _beta.push_back(norm);
+        if (norm > 0.0) {
+            for (int i = 0; i < samples; ++i)
+                p_next[i] /= norm;
+        }
+        std::swap(p_prev, p);
+        std::swap(p, p_next);
+    }
+    // _beta[0] only scales p[0]
+    _beta[0] = 0.0;
+}
+
+double
+SpectralBasis::position(float wavelength) const
+{
+    return 2.0 * (wavelength - _min_wavelength)
+        / (_max_wavelength - _min_wavelength) - 1.0;
+}
+
+float
+SpectralBasis::wavelength(int i) const
+{
+    return _min_wavelength
+        + (i + 0.5f) * (_max_wavelength - _min_wavelength) / _samples;
+}
+
+float
+SpectralBasis::eval(int k, float wavelength) const
+{
+    double x = position(wavelength);
+    double p_prev = 0.0, p = 1.0 / std::sqrt(_samples);
+    for (int j = 0; j < k; ++j) {
+        double p_next = ((x - _alpha[j]) * p - _beta[j] * p_prev) / _beta[j + 1];
+        p_prev = p;
+        p = p_next;
+    }
+    return float(p);
+}
+
+//------------------------------------------------------------------------------
+
+SpectralRenderer::SpectralRenderer(const CommandLineArguments &args) :
+    _args(args),
+    _basis(args.spectral_range[0], args.spectral_range[1],
+           args.spectral_samples, args.spectral_basis)
+{
+    if (args.stream || args.denoise || !args.features_filename.empty()
+        || !args.error_map_filename.empty() || !args.cache_directory.empty()
+        || !args.cost_filename.empty() || !args.views.empty())
+        throw std::runtime_error("Spectral basis outputs cannot be combined "
+                                 "with streaming, denoising, features, error "
+                                 "maps, cost maps, the render cache or several "
+                                 "views");
+    _renderer = std::make_unique<Renderer>(args);
+}
+
+SpectralRenderer::~SpectralRenderer() = default;
+
+void
+SpectralRenderer::render()
+{
+    using namespace std::chrono;
+
+    size_t pixel_count = _renderer->buffer().size();
+    _coefficients.assign(_basis.coefficients(),
+                         std::vector<float>(pixel_count, 0.0f));
+
+    if (!_args.quiet)
+        std::cerr << "Rendering " << _basis.samples() << " wavelengths into "
+                  << _basis.coefficients() << " spectral coefficients\n";
+    auto start = steady_clock::now();
+
+    for (int i = 0; i < _basis.samples(); ++i) {
+        float wl = _basis.wavelength(i);
+        if (!_args.quiet)
+            std::cerr << "Wavelength " << wl << " nm, " << i + 1 << "/"
+                      << _basis.samples() << "\n";
+        // Every wavelength uses the same random numbers. The noise is then
+        // correlated along the spectrum and mostly ends up in the
+        // coefficients that are kept, instead of being spread over all of
+        // them.
+        _renderer->set_wavelength(wl);
+        _renderer->render();
+        if (_renderer->cancelled())
+            return;
+
+        const std::vector<float> &pixels = _renderer->buffer();
+        for (int k = 0; k < _basis.coefficients(); ++k) {
+            float weight = _basis.eval(k, wl);
+            std::vector<float> &coefficient = _coefficients[k];
+            for (size_t p = 0; p < pixel_count; ++p)
+                coefficient[p] += weight * pixels[p];
+        }
+    }
+
+    if (!_args.quiet) {
+        std::cerr << "Finished all wavelengths";
+        print_elapsed_time(steady_clock::now() - start);
+    }
+}
+
+void
+SpectralRenderer::write(const std::string &filename)
+{
+    std::vector<std::pair<std::string, const float *>> channels;
+    for (int k = 0; k < _basis.coefficients(); ++k)
+        channels.push_back({coefficient_name(k), _coefficients[k].data()});
+
+    std::ostringstream range;
+    range << _args.spectral_range[0] << " " << _args.spectral_range[1];
+    ExrAttributes attributes = {
+        {"spectralBasis", "gram"},
+        {"spectralRange", range.str()},
+        {"spectralSamples", std::to_string(_basis.samples())},
+        {"spectralCoefficients", std::to_string(_basis.coefficients())},
+    };
+    const Renderer::Tile &window = _renderer->window();
+    ExrOptions options{_args.half_float, parse_exr_compression(_args.compression)};
+    if (!save_exr_channels(filename, window.width(), window.height(), channels,
+                           options, nullptr, &attributes))
+        throw std::runtime_error("Could not write " + filename);
+    if (!_args.quiet)
+        std::cerr << "Saved spectral coefficients [ " << filename << " ]\n";
+}
+
+//------------------------------------------------------------------------------
+
+void
+reconstruct_spectral_image(const CommandLineArguments &args)
+{
+    const std::string &input = args.reconstruct_filename;
+    int width, height;
+    std::vector<std::vector<float>> no_channels;
+    ExrAttributes attributes;
+    if (!load_exr_channels(input, width, height, {}, no_channels, &attributes))
+        throw std::runtime_error("Could not read " + input);
+    if (attributes["spectralBasis"] != "gram")
+        throw std::runtime_error(input + " does not contain spectral coefficients");
+
+    float min_wavelength = 0.0f, max_wavelength = 0.0f;
+    std::istringstream(attributes["spectralRange"]) >> min_wavelength
+                                                    >> max_wavelength;
+    int samples = std::stoi(attributes["spectralSamples"]);
+    if (args.wavelength < min_wavelength || args.wavelength > max_wavelength)
+        throw std::runtime_error("The wavelength is outside the spectral range "
+                                 "of " + input);
+
+    int count = std::stoi(attributes["spectralCoefficients"]);
+    std::vector<std::string> names;
+    for (int k = 0; k < count; ++k)
+        names.push_back(coefficient_name(k));
+    std::vector<std::vector<float>> coefficients;
+    if (!load_exr_channels(input, width, height, names, coefficients))
+        throw std::runtime_error(input + " lacks some spectral coefficients");
+
+    SpectralBasis basis(min_wavelength, max_wavelength, samples, count);
+    std::vector<float> image(size_t(width) * height, 0.0f);
+    for (int k = 0; k < count; ++k) {
+        float weight = basis.eval(k, args.wavelength);
+        for (size_t p = 0; p < image.size(); ++p)
+            image[p] += weight * coefficients[k][p];
+    }
+
+    ExrOptions options{args.half_float, parse_exr_compression(args.compression)};
+    if (!save_exr_channels(args.filename, width, height,
+                           {{"A", image.data()}}, options))
+        throw std::runtime_error("Could not write " + args.filename);
+    if (!args.quiet)
+        std::cerr << "Saved " << args.wavelength << " nm image [ "
+                  << args.filename << " ]\n";
+}
@@ -0,0 +1,93 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SPECTRAL_HXX
+#define SPECTRAL_HXX
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class CommandLineArguments;
+class Renderer;
+
+/**
+ * Polynomials that are orthonormal over samples wavelengths evenly spaced in
+ * [min_wavelength, max_wavelength], at the centers of equal bins (discrete
+ * Legendre or Gram polynomials). Sky spectra are smooth, so a handful of
+ * coefficients reconstruct them well. Unlike a cosine basis, polynomials do
+ * not force a flat spectrum at the ends of the range.
+ */
+class SpectralBasis final {
+public:
+    SpectralBasis(float min_wavelength, float max_wavelength, int samples,
+                  int coefficients);
+
+    int samples() const { return _samples; }
+    int coefficients() const { return _coefficients; }
+    float wavelength(int i) const;
+    // Basis function k at any wavelength in the range
+    float eval(int k, float wavelength) const;
+private:
+    // Position of a wavelength in [-1, 1]
+    double position(float wavelength) const;
+
+    float _min_wavelength, _max_wavelength;
+    int _samples;
+    int _coefficients;
+    // Three-term recurrence of the polynomials:
+    // p[k+1](x) = ((x - _alpha[k]) p[k](x) - _beta[k] p[k-1](x)) / _beta[k+1]
+    std::vector<double> _alpha, _beta;
+};
+
+/**
+ * Renders the spectrum of every pixel and stores it as the coefficients of a
+ * SpectralBasis (--spectral-basis) instead of one image per wavelength. The
+ * wavelengths are rendered one after the other and projected onto the basis
+ * as soon as they are done, so only one image and the coefficients are kept
+ * in memory.
+ */
+class SpectralRenderer final {
+public:
+    SpectralRenderer(const CommandLineArguments &args);
+    ~SpectralRenderer();
+
+    void render();
+    /**
+     * Write the coefficients as the channels c00, c01... of an EXR file, with
+     * the basis in its spectralBasis, spectralRange and spectralSamples
+     * attributes.
+     */
+    void write(const std::string &filename);
+private:
+    const CommandLineArguments &_args;
+    SpectralBasis _basis;
+    std::unique_ptr<Renderer> _renderer;
+    std::vector<std::vector<float>> _coefficients;
+};
+
+/**
+ * Reconstruct the image at args.wavelength from the coefficients written by
+ * SpectralRenderer (--reconstruct) and save it to args.filename.
+ */
+void reconstruct_spectral_image(const CommandLineArguments &args);
+
+#endif // SPECTRAL_HXX
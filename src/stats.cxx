@@ -0,0 +1,191 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "stats.hxx"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <tbb/enumerable_thread_specific.h>
+
+#include "args.hxx"
+#include "json.hxx"
+#include "perf.hxx"
+#include "trace.hxx"
+
+namespace {
+
+tbb::enumerable_thread_specific<RenderCounters> counters;
+
+// Write a ratio of two events, or null if it is not available
+void
+write_ratio(std::ostream &out, const PerfCounters &perf,
+            PerfCounters::Event numerator, PerfCounters::Event denominator)
+{
+    double ratio = perf.ratio(numerator, denominator);
+    if (ratio < 0.0)
+        out << "null";
+    else
+        out << ratio;
+}
+
+void
+write_perf_counters(std::ostream &out)
+{
+    PerfCounters perf = total_perf_counters();
+    out << "  \"perf_counters\": {\n";
+    for (int i = 0; i < PerfCounters::EVENT_COUNT; ++i) {
+        out << "    " << json_quote(perf_event_name(i)) << ": ";
+        if (perf.values[i] < 0)
+            out << "null";
+        else
+            out << perf.values[i];
+        out << ",\n";
+    }
+    out << "    \"ipc\": ";
+    write_ratio(out, perf, PerfCounters::INSTRUCTIONS, PerfCounters::CYCLES);
+    out << ",\n    \"cache_miss_rate\": ";
+    write_ratio(out, perf, PerfCounters::CACHE_MISSES,
+                PerfCounters::CACHE_REFERENCES);
+    out << ",\n    \"branch_miss_rate\": ";
+    write_ratio(out, perf, PerfCounters::BRANCH_MISSES, PerfCounters::BRANCHES);
+    out << ",\n    \"frontend_stall_fraction\": ";
+    write_ratio(out, perf, PerfCounters::STALLED_CYCLES_FRONTEND,
+                PerfCounters::CYCLES);
+    out << ",\n    \"backend_stall_fraction\": ";
+    write_ratio(out, perf, PerfCounters::STALLED_CYCLES_BACKEND,
+                PerfCounters::CYCLES);
+    out << "\n  },\n";
+}
+
+} // anonymous namespace
+
+void
+RenderCounters::add(const RenderCounters &other)
+{
+    camera_rays += other.camera_rays;
+    path_vertices += other.path_vertices;
+    null_collisions += other.null_collisions;
+    real_collisions += other.real_collisions;
+    shadow_rays += other.shadow_rays;
+    ground_bounces += other.ground_bounces;
+    max_path_length = std::max(max_path_length, other.max_path_length);
+    for (int i = 0; i < ORDER_BINS; ++i)
+        scattering_orders[i] += other.scattering_orders[i];
+}
+
+RenderCounters &
+thread_counters()
+{
+    return counters.local();
+}
+
+RenderCounters
+total_counters()
+{
+    RenderCounters total;
+    for (const RenderCounters &c : counters)
+        total.add(c);
+    return total;
+}
+
+void
+reset_counters()
+{
+    for (RenderCounters &c : counters)
+        c = RenderCounters();
+}
+
+//------------------------------------------------------------------------------
+
+StatsReport::StatsReport(const CommandLineArguments &args) :
+    _args(args),
+    _start(std::chrono::steady_clock::now()),
+    _phase_start(_start)
+{
+    reset_counters();
+}
+
+void
+StatsReport::end_phase(const char *name)
+{
+    auto now = std::chrono::steady_clock::now();
+    trace_event(name, "phase", _phase_start, now);
+    _phases.push_back(
+        {name, std::chrono::duration<double>(now - _phase_start).count()});
+    _phase_start = now;
+}
+
+void
+StatsReport::write(const std::string &filename) const
+{
+    RenderCounters c = total_counters();
+    double total_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - _start).count();
+    double render_seconds = 0.0;
+    for (const auto &[name, seconds] : _phases) {
+        if (name == "render")
+            render_seconds += seconds;
+    }
+
+    std::ofstream out(filename);
+    if (!out)
+        throw std::runtime_error("Could not open " + filename);
+    out.precision(9);
+    out << "{\n"
+        << "  \"image\": {\"width\": " << _args.width
+        << ", \"height\": " << _args.height
+        << ", \"samples_per_pixel\": " << _args.samples
+        << ", \"wavelength\": " << _args.wavelength << "},\n"
+        << "  \"counters\": {\n"
+        << "    \"camera_rays\": " << c.camera_rays << ",\n"
+        << "    \"path_vertices\": " << c.path_vertices << ",\n"
+        << "    \"null_collisions\": " << c.null_collisions << ",\n"
+        << "    \"real_collisions\": " << c.real_collisions << ",\n"
+        << "    \"shadow_rays\": " << c.shadow_rays << ",\n"
+        << "    \"ground_bounces\": " << c.ground_bounces << ",\n"
+        << "    \"mean_path_length\": "
+        << (c.camera_rays ? double(c.path_vertices) / c.camera_rays : 0.0)
+        << ",\n"
+        << "    \"max_path_length\": " << c.max_path_length << ",\n"
+        << "    \"scattering_orders\": [";
+    // Drop the empty bins at the end
+    int bins = RenderCounters::ORDER_BINS;
+    while (bins > 1 && c.scattering_orders[bins - 1] == 0)
+        --bins;
+    for (int i = 0; i < bins; ++i)
+        out << (i > 0 ? ", " : "") << c.scattering_orders[i];
+    out << "]\n"
+        << "  },\n";
+    if (perf_counters_enabled)
+        write_perf_counters(out);
+    out << "  \"samples_per_second\": "
+        << (render_seconds > 0.0 ? c.camera_rays / render_seconds : 0.0) << ",\n"
+        << "  \"phases\": {";
+    for (size_t i = 0; i < _phases.size(); ++i)
+        out << (i > 0 ? ", " : "") << json_quote(_phases[i].first) << ": "
+            << _phases[i].second;
+    out << "},\n"
+        << "  \"total_seconds\": " << total_seconds << "\n"
+        << "}\n";
+    if (!out)
+        throw std::runtime_error("Could not write " + filename);
+}
@@ -0,0 +1,86 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef STATS_HXX
+#define STATS_HXX
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CommandLineArguments;
+
+/**
+ * Work done by the integrators. Every thread has its own counters, so
+ * incrementing them needs no synchronization.
+ */
+struct RenderCounters {
+    // Orders beyond the last bin are counted in the last bin
+    static const int ORDER_BINS = 32;
+
+    // One per path, i.e. per call to Integrator::Li()
+    uint64_t camera_rays = 0;
+    // Real collisions plus ground bounces
+    uint64_t path_vertices = 0;
+    // Tentative collisions of delta and ratio tracking that were rejected
+    uint64_t null_collisions = 0;
+    // Scattering and absorption events in the medium
+    uint64_t real_collisions = 0;
+    uint64_t shadow_rays = 0;
+    uint64_t ground_bounces = 0;
+    uint64_t max_path_length = 0;
+    // Scattering events (in the medium or on the ground) of every order,
+    // starting with single scattering
+    uint64_t scattering_orders[ORDER_BINS] = {};
+
+    void add(const RenderCounters &other);
+};
+
+// Counters of the calling thread
+RenderCounters &thread_counters();
+// Sum of the counters of every thread
+RenderCounters total_counters();
+void reset_counters();
+
+/**
+ * Report of a run written by --stats: the counters of every thread and the
+ * time spent in each phase of the run, as JSON.
+ */
+class StatsReport final {
+public:
+    // Resets the counters and starts timing the first phase
+    StatsReport(const CommandLineArguments &args);
+
+    /**
+     * Finish the current phase and start the next one. The phase is also
+     * traced, so name must be a string literal.
+     */
+    void end_phase(const char *name);
+    void write(const std::string &filename) const;
+private:
+    const CommandLineArguments &_args;
+    std::chrono::steady_clock::time_point _start, _phase_start;
+    std::vector<std::pair<std::string, double>> _phases;
+};
+
+#endif // STATS_HXX
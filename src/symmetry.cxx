@@ -0,0 +1,81 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "symmetry.hxx"
+
+ImageSymmetry::ImageSymmetry(int width, int height, int mirror_x_offset) :
+    _width(width),
+    _height(height),
+    _mirror_x_offset(mirror_x_offset),
+    _x0(0), _x1(width), _y0(0), _y1(height)
+{
+}
+
+void
+ImageSymmetry::set_window(int x0, int x1, int y0, int y1)
+{
+    _x0 = x0; _x1 = x1;
+    _y0 = y0; _y1 = y1;
+}
+
+void
+ImageSymmetry::canonical_pixel(int x, int y, int &cx, int &cy) const
+{
+    cx = x;
+    cy = y;
+    if (_row_invariant) {
+        // Any pixel of the row will do
+        cx = _x0;
+        return;
+    }
+    for (const PixelMap &map : _maps) {
+        int mx, my;
+        apply(map, x, y, mx, my);
+        if (!inside_window(mx, my))
+            continue;
+        if (my < cy || (my == cy && mx < cx)) {
+            cx = mx;
+            cy = my;
+        }
+    }
+}
+
+bool
+ImageSymmetry::is_canonical(int x, int y) const
+{
+    int cx, cy;
+    canonical_pixel(x, y, cx, cy);
+    return cx == x && cy == y;
+}
+
+void
+ImageSymmetry::apply(const PixelMap &map, int x, int y, int &mx, int &my) const
+{
+    mx = map.swap_xy ? y : x;
+    my = map.swap_xy ? x : y;
+    if (map.mirror_x) {
+        mx = (_mirror_x_offset - mx) % _width;
+        if (mx < 0) mx += _width;
+    }
+    if (map.mirror_y) {
+        my = _height - 1 - my;
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SYMMETRY_HXX
+#define SYMMETRY_HXX
+
+#include <vector>
+
+/**
+ * Group of pixel permutations that leave a rendered image unchanged. Pixels
+ * that are mapped onto each other by the group form an orbit, and only one
+ * pixel of every orbit (the canonical pixel) needs to be rendered.
+ */
+class ImageSymmetry final {
+public:
+    /**
+     * A pixel permutation. The coordinates are swapped first (transpose), and
+     * then each axis is optionally mirrored. Mirroring on the X axis maps x to
+     * (mirror_x_offset - x) modulo the image width, which allows the mirror
+     * axis to be placed anywhere on a periodic image.
+     */
+    struct PixelMap {
+        PixelMap(bool swap_xy_, bool mirror_x_, bool mirror_y_)
+            : swap_xy(swap_xy_), mirror_x(mirror_x_), mirror_y(mirror_y_) {}
+        bool swap_xy, mirror_x, mirror_y;
+    };
+
+    ImageSymmetry(int width = 0, int height = 0, int mirror_x_offset = 0);
+
+    /**
+     * Add an element of the group. The caller is responsible for adding all
+     * the elements, i.e. the list must be closed under composition.
+     */
+    void add_map(const PixelMap &map) { _maps.push_back(map); }
+    /**
+     * Mark every row as constant, e.g. an equirectangular image of an
+     * azimuthally invariant sky.
+     */
+    void set_row_invariant() { _row_invariant = true; }
+    /**
+     * Restrict canonical pixels to the window [x0,x1)x[y0,y1). By default the
+     * whole image is used.
+     */
+    void set_window(int x0, int x1, int y0, int y1);
+
+    bool empty() const { return _maps.empty() && !_row_invariant; }
+
+    /**
+     * Find the pixel whose value must be used for (x, y). This is the first
+     * pixel of the orbit in scanline order that lies inside the window.
+     */
+    void canonical_pixel(int x, int y, int &cx, int &cy) const;
+    bool is_canonical(int x, int y) const;
+private:
+    void apply(const PixelMap &map, int x, int y, int &mx, int &my) const;
+    bool inside_window(int x, int y) const {
+        return x >= _x0 && x < _x1 && y >= _y0 && y < _y1;
+    }
+
+    int _width, _height;
+    int _mirror_x_offset;
+    int _x0, _x1, _y0, _y1;
+    bool _row_invariant = false;
+    std::vector<PixelMap> _maps;
+};
+
+#endif // SYMMETRY_HXX
@@ -0,0 +1,138 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "trace.hxx"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <tbb/enumerable_thread_specific.h>
+
+#include "json.hxx"
+
+std::atomic<bool> tracing_enabled{false};
+
+namespace {
+
+// Events kept per thread, about 4 MB
+const size_t RING_CAPACITY = 65536;
+
+struct TraceRecord {
+    const char *name;
+    const char *category;
+    std::chrono::steady_clock::time_point begin, end;
+    bool has_tile;
+    TraceTile tile;
+};
+
+struct ThreadTrace {
+    ThreadTrace() : id(next_id++) {}
+
+    int id;
+    std::vector<TraceRecord> ring;
+    size_t next = 0;
+    uint64_t dropped = 0;
+
+    static std::atomic<int> next_id;
+};
+
+std::atomic<int> ThreadTrace::next_id{0};
+
+tbb::enumerable_thread_specific<ThreadTrace> threads;
+std::chrono::steady_clock::time_point trace_start;
+
+} // anonymous namespace
+
+void
+start_tracing()
+{
+    trace_start = std::chrono::steady_clock::now();
+    tracing_enabled = true;
+}
+
+void
+trace_event(const char *name, const char *category,
+            std::chrono::steady_clock::time_point begin,
+            std::chrono::steady_clock::time_point end,
+            const TraceTile *tile)
+{
+    if (!tracing_enabled.load(std::memory_order_relaxed))
+        return;
+    ThreadTrace &thread = threads.local();
+    TraceRecord record{name, category, begin, end, tile != nullptr,
+                       tile ? *tile : TraceTile{}};
+    if (thread.ring.size() < RING_CAPACITY) {
+        thread.ring.push_back(record);
+    } else {
+        thread.ring[thread.next] = record;
+        thread.next = (thread.next + 1) % RING_CAPACITY;
+        ++thread.dropped;
+    }
+}
+
+void
+write_trace(const std::string &filename)
+{
+    using namespace std::chrono;
+
+    tracing_enabled = false;
+    std::ofstream out(filename);
+    if (!out)
+        throw std::runtime_error("Could not open " + filename);
+
+    auto micros = [](steady_clock::duration d) {
+        return duration<double, std::micro>(d).count();
+    };
+    out.precision(3);
+    out << std::fixed << "{\"traceEvents\":[\n";
+    bool first = true;
+    uint64_t dropped = 0;
+    for (const ThreadTrace &thread : threads) {
+        dropped += thread.dropped;
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << thread.id << ",\"args\":{\"name\":\"thread " << thread.id
+            << "\"}}";
+        first = false;
+        for (const TraceRecord &r : thread.ring) {
+            out << ",\n{\"name\":" << json_quote(r.name) << ",\"cat\":"
+                << json_quote(r.category) << ",\"ph\":\"X\",\"ts\":"
+                << micros(r.begin - trace_start) << ",\"dur\":"
+                << micros(r.end - r.begin) << ",\"pid\":1,\"tid\":" << thread.id;
+            if (r.has_tile)
+                out << ",\"args\":{\"x\":" << r.tile.x << ",\"y\":" << r.tile.y
+                    << ",\"width\":" << r.tile.width << ",\"height\":"
+                    << r.tile.height << ",\"samples\":" << r.tile.samples;
+            if (r.has_tile && r.tile.cycles >= 0)
+                out << ",\"cycles\":" << r.tile.cycles;
+            if (r.has_tile && r.tile.instructions >= 0)
+                out << ",\"instructions\":" << r.tile.instructions;
+            if (r.has_tile)
+                out << "}";
+            out << "}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":"
+        << dropped << "}}\n";
+    if (!out)
+        throw std::runtime_error("Could not write " + filename);
+}
@@ -0,0 +1,89 @@
+// Copyright (C) 2022  Fernando García Liñán
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TRACE_HXX
+#define TRACE_HXX
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * Timeline of the run in the Chrome trace event format (--trace), which can
+ * be opened in Perfetto or chrome://tracing. Every thread records its events
+ * in its own ring buffer, so recording takes no locks. When a buffer is full
+ * the oldest events of that thread are dropped.
+ */
+
+// Region of the image and samples traced by a tile event
+struct TraceTile {
+    int x, y, width, height;
+    int64_t samples;
+    // Hardware counters of the tile, negative if they are not counted
+    int64_t cycles = -1;
+    int64_t instructions = -1;
+};
+
+extern std::atomic<bool> tracing_enabled;
+
+void start_tracing();
+/**
+ * Record a complete event. name and category must outlive the trace, i.e.
+ * be string literals. tile is null for events that are not tiles.
+ */
+void trace_event(const char *name, const char *category,
+                 std::chrono::steady_clock::time_point begin,
+                 std::chrono::steady_clock::time_point end,
+                 const TraceTile *tile = nullptr);
+void write_trace(const std::string &filename);
+
+/**
+ * Records an event from its construction to its destruction, if tracing is
+ * enabled.
+ */
+class TraceScope final {
+public:
+    TraceScope(const char *name, const char *category) :
+        _name(name), _category(category),
+        _enabled(tracing_enabled.load(std::memory_order_relaxed))
+    {
+        if (_enabled)
+            _begin = std::chrono::steady_clock::now();
+    }
+    ~TraceScope() {
+        if (_enabled)
+            trace_event(_name, _category, _begin,
+                        std::chrono::steady_clock::now(),
+                        _has_tile ? &_tile : nullptr);
+    }
+    // Describe the tile traced by this event
+    void set_tile(const TraceTile &tile) { _tile = tile; _has_tile = true; }
+private:
+    const char *_name;
+    const char *_category;
+    bool _enabled;
+    bool _has_tile = false;
+    TraceTile _tile;
+    std::chrono::steady_clock::time_point _begin;
+};
+
+#endif // TRACE_HXX